@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "server.h"
+#include "stats.h"
+
+// NOTE(ariel) This program measures the caches in two ways.
+//
+// First, how the shared cache behaves under contention. Every thread looks up
+// random names among a fixed set, all present in the cache, and replaces one
+// entry in every `BENCH_WRITE_RATIO` operations. The baseline runs the same
+// operations behind one global mutex, as a plain shared hash table would.
+//
+// Second, how much memory the cache of a thread holds over a long run of
+// unique names, which must level off at its ceiling, and what each entry
+// costs beyond its records. The names themselves take memory as well, so the
+// run recycles its table of names along with the cache every
+// `SERVER_NAME_LIMIT` names, as a worker of the server does, and reports the
+// resident memory of the whole process, which must level off too.
+
+enum {
+    BENCH_NAMES = 4096,
+    BENCH_OPERATIONS = 1000000,
+    BENCH_WRITE_RATIO = 64,
+
+    BENCH_UNIQUE_NAMES = 2000000,
+    BENCH_REPORT_INTERVAL = 250000,
+    BENCH_CACHE_CAPACITY = 1 << 16,
+    BENCH_CACHE_LIMIT = MB(8),
+};
+
+typedef struct {
+    Shared_Cache *cache;
+    pthread_mutex_t *lock;
+    u32 seed;
+    u64 hits;
+    pthread_t thread;
+} Contender;
+
+internal Name_ID
+bench_name(u32 i)
+{
+    char text[32] = {0};
+    int len = snprintf(text, sizeof(text), "n%u.bench.test", i);
+    return intern_text(&g_names, (String){ .str = (u8 *)text, .len = len });
+}
+
+internal Resource_Record
+bench_record(Name_ID name, u32 i)
+{
+    return (Resource_Record){
+        .owner = name,
+        .type = RR_TYPE_A,
+        .class = RR_CLASS_IN,
+        .ttl = 3600,
+        .rdlength = 4,
+        .rdata.a = { 10, i >> 16, i >> 8, i },
+    };
+}
+
+internal void *
+contend(void *arg)
+{
+    Contender *contender = arg;
+    arena_init(&g_arena);
+    intern_init(&g_names);
+
+    // NOTE(ariel) IDs are local to this thread, so intern every name before
+    // the clock starts.
+    Name_ID *names = malloc(BENCH_NAMES * sizeof(Name_ID));
+    if (!names) err_exit("failed to allocate names");
+    for (u32 i = 0; i < BENCH_NAMES; ++i) names[i] = bench_name(i);
+
+    u32 x = contender->seed;
+    for (u32 i = 0; i < BENCH_OPERATIONS; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        u32 n = x % BENCH_NAMES;
+
+        if (contender->lock) pthread_mutex_lock(contender->lock);
+        if (i % BENCH_WRITE_RATIO == 0) {
+            Resource_Record rr = bench_record(names[n], n);
+            Resource_Record_Array rs = { .rrs = &rr, .count = 1 };
+            shared_cache_insert(contender->cache, names[n], RR_TYPE_A, DNS_RCODE_NOERROR, rs, rr.ttl);
+        } else {
+            u16 rcode = 0;
+            Resource_Record_Array rs = {0};
+            contender->hits += shared_cache_lookup(contender->cache, names[n], RR_TYPE_A, &rcode, &rs);
+        }
+        if (contender->lock) pthread_mutex_unlock(contender->lock);
+
+        arena_clear(&g_arena);
+    }
+
+    free(names);
+    intern_release(&g_names);
+    arena_release(&g_arena);
+    return 0;
+}
+
+internal double
+run(Shared_Cache *cache, pthread_mutex_t *lock, u32 threads, double *hit_rate)
+{
+    Contender *contenders = calloc(threads, sizeof(Contender));
+    if (!contenders) err_exit("failed to allocate contenders");
+
+    u64 start = stats_now();
+    for (u32 i = 0; i < threads; ++i) {
+        contenders[i].cache = cache;
+        contenders[i].lock = lock;
+        contenders[i].seed = 0x9e3779b9 * (i + 1);
+        if (pthread_create(&contenders[i].thread, 0, contend, &contenders[i]))
+            err_exit("failed to start thread %u", i);
+    }
+
+    u64 hits = 0;
+    for (u32 i = 0; i < threads; ++i) {
+        pthread_join(contenders[i].thread, 0);
+        hits += contenders[i].hits;
+    }
+    u64 elapsed = stats_now() - start;
+    free(contenders);
+
+    u64 operations = (u64)threads * BENCH_OPERATIONS;
+    *hit_rate = (double)hits / (operations - operations / BENCH_WRITE_RATIO);
+    return operations / ((double)elapsed / 1e9);
+}
+
+internal double
+resident_megabytes(void)
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(statm);
+    return (double)resident * sysconf(_SC_PAGESIZE) / MB(1);
+}
+
+internal void
+measure_memory(void)
+{
+    Cache cache = {0};
+    cache_init(&cache, BENCH_CACHE_CAPACITY, BENCH_CACHE_LIMIT);
+
+    printf("\n%10s %10s %12s %12s %12s %12s %10s\n",
+            "inserted", "entries", "committed", "arena", "names", "resident", "overhead");
+    for (u32 i = 1; i <= BENCH_UNIQUE_NAMES; ++i) {
+        if (g_names.count >= SERVER_NAME_LIMIT) {
+            cache_release(&cache);
+            intern_release(&g_names);
+            intern_init(&g_names);
+            cache_init(&cache, BENCH_CACHE_CAPACITY, BENCH_CACHE_LIMIT);
+        }
+
+        // NOTE(ariel) Vary the size of answers between one and four records,
+        // so entries spread over several size classes.
+        Name_ID name = bench_name(i);
+        Resource_Record rrs[4] = {0};
+        for (u32 j = 0; j < 4; ++j) rrs[j] = bench_record(name, i + j);
+        Resource_Record_Array rs = { .rrs = rrs, .count = 1 + i % 4 };
+        cache_insert(&cache, name, RR_TYPE_A, DNS_RCODE_NOERROR, rs, 3600);
+
+        if (i % BENCH_REPORT_INTERVAL == 0) {
+            Cache_Usage usage = cache_usage(&cache);
+            size_t names = g_names.strings.cap + g_names.entries.cap + g_names.slots.cap;
+            printf("%10u %10u %11.2fM %11.2fM %11.2fM %11.2fM %9.1fB\n", i, usage.entries,
+                    (double)usage.committed / MB(1), (double)cache.arena.cap / MB(1),
+                    (double)names / MB(1), resident_megabytes(),
+                    (double)(usage.committed - usage.payload) / usage.entries);
+        }
+    }
+
+    cache_release(&cache);
+}
+
+int
+main(int argc, char *argv[])
+{
+    u32 limit = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    if (argc == 2) {
+        limit = strtoul(argv[1], 0, 10);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [max-threads]\n", argv[0]);
+        exit(1);
+    }
+
+    arena_init(&g_arena);
+    intern_init(&g_names);
+
+    Shared_Cache cache = {0};
+    shared_cache_init(&cache, 4 * BENCH_NAMES);
+    for (u32 i = 0; i < BENCH_NAMES; ++i) {
+        Name_ID name = bench_name(i);
+        Resource_Record rr = bench_record(name, i);
+        Resource_Record_Array rs = { .rrs = &rr, .count = 1 };
+        shared_cache_insert(&cache, name, RR_TYPE_A, DNS_RCODE_NOERROR, rs, rr.ttl);
+    }
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    printf("%8s %14s %14s %8s\n", "threads", "lock-free/s", "mutex/s", "hits");
+    for (u32 threads = 1; threads <= limit; threads *= 2) {
+        double hit_rate = 0;
+        double lock_free = run(&cache, 0, threads, &hit_rate);
+        double locked = run(&cache, &lock, threads, &(double){0});
+        printf("%8u %14.0f %14.0f %7.1f%%\n", threads, lock_free, locked, 100 * hit_rate);
+    }
+
+    shared_cache_release(&cache);
+    measure_memory();
+    intern_release(&g_names);
+    arena_release(&g_arena);
+    exit(0);
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "str.h"
+
+// NOTE(ariel) This program measures the parser in isolation. It builds a
+// corpus of replies shaped like the ones the resolver receives in practice,
+// parses each of them repeatedly and reports the time and arena memory spent
+// per message. With `-o dir` it also writes the corpus to `dir` to seed the
+// fuzzer in `fuzz/parse_fuzz.c`.
+
+enum {
+    ITERATIONS = 100000,
+    SUFFIX_LIMIT = 512,
+};
+
+typedef struct {
+    u8 buf[UINT16_MAX];
+    size_t len;
+
+    // NOTE(ariel) Offsets of every name suffix written so far for the purpose
+    // of compression.
+    struct { String name; u16 offset; } suffixes[SUFFIX_LIMIT];
+    size_t suffix_count;
+    u8 names[UINT16_MAX];
+    size_t names_len;
+} Writer;
+
+typedef struct {
+    char *label;
+    Writer *msg;
+} Sample;
+
+internal void
+put_u16(Writer *w, u16 i)
+{
+    w->buf[w->len++] = i >> 8;
+    w->buf[w->len++] = i;
+}
+
+internal void
+put_u32(Writer *w, u32 i)
+{
+    put_u16(w, i >> 16);
+    put_u16(w, i);
+}
+
+internal void
+put_name(Writer *w, char *s)
+{
+    String name = { .str = w->names + w->names_len, .len = strlen(s) };
+    assert(w->names_len + name.len <= sizeof(w->names));
+    memcpy(name.str, s, name.len);
+    w->names_len += name.len;
+
+    while (name.len) {
+        for (size_t i = 0; i < w->suffix_count; ++i) {
+            if (string_cmp(w->suffixes[i].name, name)) {
+                put_u16(w, 0xc000 | w->suffixes[i].offset);
+                return;
+            }
+        }
+
+        if (w->suffix_count < SUFFIX_LIMIT && w->len < 0x4000) {
+            w->suffixes[w->suffix_count].name = name;
+            w->suffixes[w->suffix_count].offset = w->len;
+            ++w->suffix_count;
+        }
+
+        size_t len = 0;
+        while (len < name.len && name.str[len] != '.') ++len;
+
+        w->buf[w->len++] = len;
+        memcpy(w->buf + w->len, name.str, len);
+        w->len += len;
+
+        len = MIN(len + 1, name.len);
+        name.str += len;
+        name.len -= len;
+    }
+
+    w->buf[w->len++] = 0;
+}
+
+internal void
+put_header(Writer *w, u16 flags, u16 ancount, u16 nscount, u16 arcount)
+{
+    put_u16(w, 0xbeef);
+    put_u16(w, flags);
+    put_u16(w, 1);
+    put_u16(w, ancount);
+    put_u16(w, nscount);
+    put_u16(w, arcount);
+}
+
+internal void
+put_question(Writer *w, char *name, u16 type)
+{
+    put_name(w, name);
+    put_u16(w, type);
+    put_u16(w, RR_CLASS_IN);
+}
+
+internal void
+put_rr_header(Writer *w, char *name, u16 type, u16 rdlength)
+{
+    put_name(w, name);
+    put_u16(w, type);
+    put_u16(w, RR_CLASS_IN);
+    put_u32(w, 172800);
+    put_u16(w, rdlength);
+}
+
+internal void
+put_rr_name(Writer *w, char *name, u16 type, char *target)
+{
+    put_rr_header(w, name, type, 0);
+    size_t rdlength = w->len - 2;
+    put_name(w, target);
+    u16 len = w->len - rdlength - 2;
+    w->buf[rdlength] = len >> 8;
+    w->buf[rdlength + 1] = len;
+}
+
+internal void
+put_rr_a(Writer *w, char *name, u32 ip)
+{
+    put_rr_header(w, name, RR_TYPE_A, 4);
+    put_u32(w, ip);
+}
+
+internal void
+put_rr_aaaa(Writer *w, char *name, u32 ip)
+{
+    put_rr_header(w, name, RR_TYPE_AAAA, 16);
+    put_u32(w, 0x20010503);
+    put_u32(w, 0);
+    put_u32(w, 0);
+    put_u32(w, ip);
+}
+
+internal Writer *
+build_root_referral(void)
+{
+    Writer *w = calloc(1, sizeof(Writer));
+    put_header(w, 0x8000, 0, 13, 26);
+    put_question(w, "www.example.com", RR_TYPE_A);
+
+    char server[32] = {0};
+    for (int i = 0; i < 13; ++i) {
+        snprintf(server, sizeof(server), "%c.gtld-servers.net", 'a' + i);
+        put_rr_name(w, "com", RR_TYPE_NS, server);
+    }
+    for (int i = 0; i < 13; ++i) {
+        snprintf(server, sizeof(server), "%c.gtld-servers.net", 'a' + i);
+        put_rr_a(w, server, 0xc0050000 | i);
+        put_rr_aaaa(w, server, 0x30 + i);
+    }
+
+    return w;
+}
+
+internal Writer *
+build_large_glue(void)
+{
+    Writer *w = calloc(1, sizeof(Writer));
+    put_header(w, 0x8000, 0, 40, 120);
+    put_question(w, "host.department.example.org", RR_TYPE_A);
+
+    char server[64] = {0};
+    for (int i = 0; i < 40; ++i) {
+        snprintf(server, sizeof(server), "ns%d.dns-provider-%d.example.net", i, i % 4);
+        put_rr_name(w, "example.org", RR_TYPE_NS, server);
+    }
+    for (int i = 0; i < 40; ++i) {
+        snprintf(server, sizeof(server), "ns%d.dns-provider-%d.example.net", i, i % 4);
+        put_rr_a(w, server, 0x0a000000 | i);
+        put_rr_a(w, server, 0x0a010000 | i);
+        put_rr_aaaa(w, server, i);
+    }
+
+    return w;
+}
+
+internal Writer *
+build_deep_compression(void)
+{
+    Writer *w = calloc(1, sizeof(Writer));
+    put_header(w, 0x8400, 60, 0, 0);
+    put_question(w, "example.com", RR_TYPE_CNAME);
+
+    // NOTE(ariel) Each owner name adds one label to the previous one, so the
+    // parser must follow a chain of pointers one hop longer for every record.
+    char name[DNS_DOMAIN_LIMIT] = "example.com";
+    for (int i = 0; i < 60; ++i) {
+        char next[DNS_DOMAIN_LIMIT] = {0};
+        snprintf(next, sizeof(next), "x.%.*s", (int)sizeof(next) - 3, name);
+        put_rr_name(w, next, RR_TYPE_CNAME, name);
+        memcpy(name, next, sizeof(name));
+    }
+
+    return w;
+}
+
+internal Writer *
+build_answer(void)
+{
+    Writer *w = calloc(1, sizeof(Writer));
+    put_header(w, 0x8400, 6, 0, 0);
+    put_question(w, "www.example.com", RR_TYPE_A);
+
+    put_rr_name(w, "www.example.com", RR_TYPE_CNAME, "www.example.com.cdn.example.net");
+    put_rr_name(w, "www.example.com.cdn.example.net", RR_TYPE_CNAME, "edge.cdn.example.net");
+    for (u32 i = 0; i < 4; ++i) put_rr_a(w, "edge.cdn.example.net", 0x5db8d800 | i);
+
+    return w;
+}
+
+internal u64
+now_ns(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+internal void
+write_corpus(char *dir, Sample *samples, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        char path[4096] = {0};
+        snprintf(path, sizeof(path), "%s/%s", dir, samples[i].label);
+
+        FILE *f = fopen(path, "wb");
+        if (!f) err_exit("failed to open %s for writing", path);
+        if (fwrite(samples[i].msg->buf, 1, samples[i].msg->len, f) != samples[i].msg->len)
+            err_exit("failed to write %s", path);
+        fclose(f);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    arena_init(&g_arena);
+    intern_init(&g_names);
+
+    Sample samples[] = {
+        { "root-referral",    build_root_referral()    },
+        { "large-glue",       build_large_glue()       },
+        { "deep-compression", build_deep_compression() },
+        { "answer",           build_answer()           },
+    };
+    size_t count = sizeof(samples) / sizeof(*samples);
+
+    if (argc == 3 && !strcmp(argv[1], "-o")) {
+        write_corpus(argv[2], samples, count);
+        exit(0);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [-o corpus-directory]\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%-18s %8s %10s %12s\n", "message", "bytes", "ns/msg", "alloc/msg");
+    for (size_t i = 0; i < count; ++i) {
+        String buf = { .str = samples[i].msg->buf, .len = samples[i].msg->len };
+
+        DNS_Reply reply = {0};
+        if (!parse_reply(&reply, buf)) err_exit("failed to parse sample %s", samples[i].label);
+        size_t alloc = g_arena.curr;
+        arena_clear(&g_arena);
+
+        u64 start = now_ns();
+        for (int j = 0; j < ITERATIONS; ++j) {
+            (void)parse_reply(&reply, buf);
+            arena_clear(&g_arena);
+        }
+        u64 elapsed = now_ns() - start;
+
+        printf("%-18s %8zu %10.1f %12zu\n",
+                samples[i].label, buf.len, (double)elapsed / ITERATIONS, alloc);
+    }
+
+    intern_release(&g_names);
+    arena_release(&g_arena);
+    exit(0);
+}
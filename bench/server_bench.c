@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "server.h"
+
+// NOTE(ariel) This program measures how the throughput of the server scales
+// with the number of workers. It warms the cache of every worker with the
+// same synthetic names, so each query is answered without any traffic to
+// nameservers, and drives the server from as many clients as workers for a
+// fixed duration per configuration.
+
+enum {
+    BENCH_PORT = 6353,
+    BENCH_NAMES = 1024,
+    BENCH_SECONDS = 1,
+    BENCH_WINDOW = 16,
+};
+
+typedef struct {
+    u16 port;
+    volatile bool *running;
+    u64 answers;
+    pthread_t thread;
+} Client;
+
+internal void
+warm(u32 worker)
+{
+    (void)worker;
+
+    for (u32 i = 0; i < BENCH_NAMES; ++i) {
+        char text[32] = {0};
+        int len = snprintf(text, sizeof(text), "n%u.bench.test", i);
+        Name_ID name = intern_text(&g_names, (String){ .str = (u8 *)text, .len = len });
+
+        Resource_Record rr = {
+            .owner = name,
+            .type = RR_TYPE_A,
+            .class = RR_CLASS_IN,
+            .ttl = 3600,
+            .rdlength = 4,
+            .rdata.a = { 10, 0, i >> 8, i },
+        };
+        Resource_Record_Array rs = { .rrs = &rr, .count = 1 };
+        cache_insert(t_cache, name, RR_TYPE_A, DNS_RCODE_NOERROR, rs, rr.ttl);
+    }
+}
+
+internal size_t
+build_query(u8 *buf, u16 id, u32 i)
+{
+    size_t len = 0;
+    buf[len++] = id >> 8;
+    buf[len++] = id;
+    buf[len++] = 0x01;
+    buf[len++] = 0x00;
+    buf[len++] = 0; buf[len++] = 1;
+    memset(buf + len, 0, 6);
+    len += 6;
+
+    char label[16] = {0};
+    int n = snprintf(label, sizeof(label), "n%u", i);
+    buf[len++] = n;
+    memcpy(buf + len, label, n);
+    len += n;
+    buf[len++] = 5;
+    memcpy(buf + len, "bench", 5);
+    len += 5;
+    buf[len++] = 4;
+    memcpy(buf + len, "test", 4);
+    len += 4;
+    buf[len++] = 0;
+
+    buf[len++] = 0; buf[len++] = RR_TYPE_A;
+    buf[len++] = 0; buf[len++] = RR_CLASS_IN;
+    return len;
+}
+
+internal void *
+drive(void *arg)
+{
+    Client *client = arg;
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == -1) err_exit("failed to open socket for client");
+
+    struct timeval timeout = { .tv_usec = 100000 };
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+        err_exit("failed to set timeout option for socket of client");
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(client->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        err_exit("failed to connect client to server");
+
+    // NOTE(ariel) Keep a small window of queries in flight, so the client
+    // measures the server rather than the round trip through loopback.
+    u32 i = 0;
+    u8 buf[UDP_MSG_LIMIT] = {0};
+    for (u32 j = 0; j < BENCH_WINDOW; ++j, ++i) {
+        size_t len = build_query(buf, i, i % BENCH_NAMES);
+        (void)send(sockfd, buf, len, 0);
+    }
+
+    while (*client->running) {
+        if (recv(sockfd, buf, sizeof(buf), 0) > 0) {
+            ++client->answers;
+        }
+        size_t len = build_query(buf, i, i % BENCH_NAMES);
+        (void)send(sockfd, buf, len, 0);
+        ++i;
+    }
+
+    close(sockfd);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    u32 limit = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    if (argc == 2) {
+        limit = strtoul(argv[1], 0, 10);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [max-workers]\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%8s %14s %10s\n", "workers", "queries/sec", "speedup");
+    double base = 0;
+    for (u32 workers = 1; workers <= limit; workers *= 2) {
+        Server_Config config = {
+            .port = BENCH_PORT,
+            .workers = workers,
+            .cache_capacity = BENCH_NAMES,
+            .pin = true,
+            .worker_init = warm,
+        };
+        Server *server = server_start(config);
+
+        volatile bool running = true;
+        Client *clients = calloc(workers, sizeof(Client));
+        if (!clients) err_exit("failed to allocate clients");
+        for (u32 i = 0; i < workers; ++i) {
+            clients[i].port = BENCH_PORT;
+            clients[i].running = &running;
+            if (pthread_create(&clients[i].thread, 0, drive, &clients[i]))
+                err_exit("failed to start client %u", i);
+        }
+
+        sleep(BENCH_SECONDS);
+        running = false;
+
+        u64 answers = 0;
+        for (u32 i = 0; i < workers; ++i) {
+            pthread_join(clients[i].thread, 0);
+            answers += clients[i].answers;
+        }
+        free(clients);
+        server_stop(server);
+
+        double qps = (double)answers / BENCH_SECONDS;
+        if (!base) base = qps;
+        printf("%8u %14.0f %9.2fx\n", workers, qps, qps / base);
+    }
+
+    exit(0);
+}
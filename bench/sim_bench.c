@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "forward.h"
+#include "intern.h"
+#include "sim.h"
+#include "stats.h"
+
+// NOTE(ariel) This program compares strategies of the resolver on a simulated
+// network, where every run spans seconds of virtual time, finishes in a blink
+// and repeats exactly for the same seed.
+//
+// First, iteration from the root through a TLD to an authoritative server for
+// many zones, under growing loss, for several intervals of retransmission.
+// Second, forwarding to a pool of three upstreams for each policy and several
+// intervals of retransmission: one upstream is steady but goes silent for a
+// few seconds in the middle of the run, one usually answers fast but has a
+// long tail of latency and duplicates replies, and one loses some messages.
+//
+// Each run starts resolutions of unique names at a fixed rate and reports
+// percentiles of their latency in virtual time, the resolutions that failed
+// and the queries each server received.
+
+enum {
+    BENCH_SEED = 42,
+    BENCH_RESOLUTIONS = 20000,
+    BENCH_INTERVAL = 500000,   // NOTE(ariel) A resolution starts every 0.5 ms.
+    BENCH_ZONES = 100,
+    BENCH_CACHE_CAPACITY = 1 << 16,
+    BENCH_CACHE_LIMIT = MB(32),
+    BENCH_TTL = 3600,
+};
+
+global u64 RETRANSMIT_MS[] = { 100, 200, 400, 800 };
+global double LOSS[] = { 0, 0.02, 0.1 };
+
+typedef struct {
+    Sim_Network *network;
+    u64 *latencies;
+    u32 count;
+    u32 failures;
+} Run;
+
+typedef struct {
+    Run *run;
+    u64 start;
+} Request;
+
+
+/* ---
+ * Answer queries of the simulated servers.
+ * ---
+ */
+
+// NOTE(ariel) Copy the header and question of a query into its reply, note
+// where each label of the name starts, and return the length, or zero if the
+// query makes no sense.
+internal size_t
+begin_reply(u8 *query, size_t len, u8 *reply, u16 flags, u16 *labels, u32 *label_count)
+{
+    size_t cursor = DNS_HEADER_LIMIT;
+    *label_count = 0;
+    while (cursor < len && query[cursor]) {
+        if (*label_count == 8) return 0;
+        labels[(*label_count)++] = cursor;
+        cursor += query[cursor] + 1;
+    }
+    cursor += 5;
+    if (cursor > len) return 0;
+
+    memcpy(reply, query, cursor);
+    u16 rd = (query[2] << 8 | query[3]) & DNS_HEADER_FLAG_RD;
+    flags |= DNS_HEADER_FLAG_QR | rd;
+    reply[2] = flags >> 8;
+    reply[3] = flags;
+    memset(&reply[6], 0, 6);
+    return cursor;
+}
+
+// NOTE(ariel) Append a record whose owner points into the message.
+internal size_t
+put_record(u8 *buf, size_t len, u16 owner, u16 type, u8 *rdata, u16 rdlength)
+{
+    u8 record[] = {
+        0xc0 | owner >> 8, owner, type >> 8, type, 0, RR_CLASS_IN,
+        BENCH_TTL >> 24, BENCH_TTL >> 16, BENCH_TTL >> 8, BENCH_TTL & 0xff, rdlength >> 8, rdlength,
+    };
+    memcpy(buf + len, record, sizeof(record));
+    memcpy(buf + len + sizeof(record), rdata, rdlength);
+    return len + sizeof(record) + rdlength;
+}
+
+internal size_t
+answer(u8 *reply, size_t len, u32 seed)
+{
+    u8 a[4] = { 10, 9, seed >> 8, seed };
+    reply[7] = 1;
+    return put_record(reply, len, DNS_HEADER_LIMIT, RR_TYPE_A, a, sizeof(a));
+}
+
+// NOTE(ariel) The server of each level of the hierarchy refers the resolver
+// to the next one: the root delegates `test.`, the TLD server delegates each
+// zone under it, and the authoritative server answers for every zone.
+typedef struct {
+    u32 level;
+    u8 next[4];
+} Zone_Server;
+
+internal size_t
+serve_zone(void *user, u8 *query, size_t len, u8 *reply, size_t cap)
+{
+    (void)cap;
+    Zone_Server *server = user;
+    u16 labels[8] = {0};
+    u32 count = 0;
+
+    if (server->level == 2) {
+        len = begin_reply(query, len, reply, DNS_HEADER_FLAG_AA, labels, &count);
+        return len ? answer(reply, len, len) : 0;
+    }
+
+    len = begin_reply(query, len, reply, 0, labels, &count);
+    if (!len || count <= server->level) return 0;
+
+    // NOTE(ariel) The NS record names `ns.` plus the zone cut, and the glue
+    // takes that name as its owner.
+    u16 cut = labels[count - 1 - server->level];
+    u8 ns[] = { 2, 'n', 's', 0xc0 | cut >> 8, cut };
+    size_t glue = len + DNS_HEADER_LIMIT;
+    reply[9] = 1;
+    reply[11] = 1;
+    len = put_record(reply, len, cut, RR_TYPE_NS, ns, sizeof(ns));
+    return put_record(reply, len, glue, RR_TYPE_A, server->next, sizeof(server->next));
+}
+
+internal size_t
+serve_upstream(void *user, u8 *query, size_t len, u8 *reply, size_t cap)
+{
+    (void)user;
+    (void)cap;
+    u16 labels[8] = {0};
+    u32 count = 0;
+    len = begin_reply(query, len, reply, DNS_HEADER_FLAG_RA, labels, &count);
+    return len ? answer(reply, len, len) : 0;
+}
+
+
+/* ---
+ * Run resolutions and summarize them.
+ * ---
+ */
+
+internal void
+done(void *user, Resolution *resolution)
+{
+    Request *request = user;
+    Run *run = request->run;
+    if (resolution->status || resolution->rcode != DNS_RCODE_NOERROR || !resolution->answer.count) {
+        ++run->failures;
+    } else {
+        run->latencies[run->count++] = run->network->now - request->start;
+    }
+}
+
+internal int
+compare_latencies(const void *a, const void *b)
+{
+    u64 x = *(u64 *)a;
+    u64 y = *(u64 *)b;
+    return (x > y) - (x < y);
+}
+
+internal double
+percentile(Run *run, double p)
+{
+    if (!run->count) return 0;
+    u32 i = MIN((u32)(p * run->count), run->count - 1);
+    return run->latencies[i] / 1e6;
+}
+
+internal void
+run(Sim_Network *n, u64 retransmit_ms, Run *result)
+{
+    Resolver *r = resolver_create_on(&n->transport);
+    Request *requests = calloc(BENCH_RESOLUTIONS, sizeof(Request));
+    if (!r || !requests) err_exit("failed to set up simulated run");
+    resolver_set_retransmit(r, retransmit_ms * 1000000);
+
+    Cache cache = {0};
+    intern_init(&g_names);
+    cache_init(&cache, BENCH_CACHE_CAPACITY, BENCH_CACHE_LIMIT);
+    t_cache = &cache;
+
+    *result = (Run){ .network = n, .latencies = calloc(BENCH_RESOLUTIONS, sizeof(u64)) };
+    if (!result->latencies) err_exit("failed to set up simulated run");
+
+    for (u32 i = 0; i < BENCH_RESOLUTIONS; ++i) {
+        Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+        sim_run(n, r, (u64)i * BENCH_INTERVAL);
+
+        char text[32] = {0};
+        int len = snprintf(text, sizeof(text), "n%u.z%u.test", i, i % BENCH_ZONES);
+        Name_ID name = intern_text(&g_names, (String){ .str = (u8 *)text, .len = len });
+        requests[i] = (Request){ .run = result, .start = n->now };
+        if (resolver_start(r, name, RR_TYPE_A, done, &requests[i])) ++result->failures;
+        arena_checkpoint_restore(cp);
+    }
+
+    Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+    sim_run(n, r, UINT64_MAX);
+    arena_checkpoint_restore(cp);
+    qsort(result->latencies, result->count, sizeof(u64), compare_latencies);
+
+    t_cache = 0;
+    cache_release(&cache);
+    intern_release(&g_names);
+    free(requests);
+    resolver_destroy(r);
+}
+
+internal void
+print_run(char *label, u64 retransmit_ms, Run *result)
+{
+    printf("%-18s %6llums %8.1f %8.1f %8.1f %8u", label, (unsigned long long)retransmit_ms,
+            percentile(result, 0.5), percentile(result, 0.9), percentile(result, 0.99), result->failures);
+    for (u32 i = 0; i < result->network->server_count; ++i) {
+        printf(" %8llu", (unsigned long long)result->network->servers[i].queries);
+    }
+    printf("\n");
+    free(result->latencies);
+}
+
+
+/* ---
+ * Set up each scenario.
+ * ---
+ */
+
+internal void
+iterate(void)
+{
+    Zone_Server root = { .level = 0, .next = { 10, 1, 0, 1 } };
+    Zone_Server tld = { .level = 1, .next = { 10, 1, 0, 2 } };
+    Zone_Server auth = { .level = 2 };
+
+    printf("iteration from the root, latency in ms\n");
+    printf("%-18s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+            "loss", "rto", "p50", "p90", "p99", "failed", "root", "tld", "auth");
+    for (u32 i = 0; i < sizeof(LOSS) / sizeof(*LOSS); ++i) {
+        for (u32 j = 0; j < sizeof(RETRANSMIT_MS) / sizeof(*RETRANSMIT_MS); ++j) {
+            Sim_Link link = {
+                .distribution = SIM_LATENCY_UNIFORM,
+                .latency = 5000000,
+                .jitter = 10000000,
+                .loss = LOSS[i],
+                .duplicate = 0.02,
+            };
+            Sim_Link far = link;
+            far.distribution = SIM_LATENCY_EXPONENTIAL;
+            far.jitter = 15000000;
+
+            Sim_Network n = {0};
+            sim_init(&n, BENCH_SEED);
+            sim_add_server(&n, "198.41.0.4", link, serve_zone, &root);
+            sim_add_server(&n, "10.1.0.1", link, serve_zone, &tld);
+            sim_add_server(&n, "10.1.0.2", far, serve_zone, &auth);
+
+            char label[16] = {0};
+            snprintf(label, sizeof(label), "%.0f%%", 100 * LOSS[i]);
+            Run result = {0};
+            run(&n, RETRANSMIT_MS[j], &result);
+            print_run(label, RETRANSMIT_MS[j], &result);
+            sim_release(&n);
+        }
+    }
+}
+
+internal void
+forward(void)
+{
+    char *upstreams[] = { "10.0.0.1", "10.0.0.2", "10.0.0.3" };
+    char *policies[] = { "round-robin", "least-outstanding", "fastest" };
+
+    printf("\nforwarding to a pool, latency in ms\n");
+    printf("%-18s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+            "policy", "rto", "p50", "p90", "p99", "failed", "steady", "tail", "lossy");
+    for (u32 i = 0; i < sizeof(policies) / sizeof(*policies); ++i) {
+        for (u32 j = 0; j < sizeof(RETRANSMIT_MS) / sizeof(*RETRANSMIT_MS); ++j) {
+            Sim_Link steady = {
+                .distribution = SIM_LATENCY_UNIFORM,
+                .latency = 3000000,
+                .jitter = 4000000,
+                .failure = SIM_FAILURE_SILENT,
+                .failure_start = 4000000000ull,
+                .failure_end = 7000000000ull,
+            };
+            Sim_Link tail = {
+                .distribution = SIM_LATENCY_EXPONENTIAL,
+                .latency = 1000000,
+                .jitter = 20000000,
+                .duplicate = 0.05,
+            };
+            Sim_Link lossy = {
+                .distribution = SIM_LATENCY_FIXED,
+                .latency = 5000000,
+                .loss = 0.15,
+            };
+
+            Sim_Network n = {0};
+            sim_init(&n, BENCH_SEED);
+            sim_add_server(&n, upstreams[0], steady, serve_upstream, 0);
+            sim_add_server(&n, upstreams[1], tail, serve_upstream, 0);
+            sim_add_server(&n, upstreams[2], lossy, serve_upstream, 0);
+            forward_configure(upstreams, sizeof(upstreams) / sizeof(*upstreams), forward_policy_from_string(policies[i]));
+
+            Run result = {0};
+            run(&n, RETRANSMIT_MS[j], &result);
+            print_run(policies[i], RETRANSMIT_MS[j], &result);
+            sim_release(&n);
+        }
+    }
+    forward_configure(0, 0, FORWARD_ROUND_ROBIN);
+}
+
+int
+main(void)
+{
+    arena_init(&g_arena);
+    stats_thread_init();
+
+    iterate();
+    forward();
+
+    arena_release(&g_arena);
+    exit(0);
+}
@@ -5,12 +5,54 @@ set -eux
 DEBUG="-DDEBUG -g -O0"
 RELEASE="-O2"
 WARNINGS="-Wall -Wextra -Wpedantic"
-FLAGS="-D_FORTIFY_SOURCE=2 $WARNINGS"
+FLAGS="-D_FORTIFY_SOURCE=2 -pthread $WARNINGS"
+FUZZ=0
 
-if [ $# -eq 1 ] && [ "$1" = "--debug" ]; then
+for arg in "$@"; do
+    case "$arg" in
+        --debug) DEBUG_BUILD=1 ;;
+        --fuzz) FUZZ=1 ;;
+        *) echo "usage: $0 [--debug] [--fuzz]" >&2; exit 1 ;;
+    esac
+done
+
+if [ "${DEBUG_BUILD:-0}" -eq 1 ]; then
     FLAGS="$FLAGS $DEBUG"
 else
     FLAGS="$FLAGS $RELEASE"
 fi
 
+LIBRARY=$(ls src/*.c | grep -v '^src/resolver.c$')
+
 gcc $FLAGS -Iinclude/ src/* -o dnsresolver
+gcc $FLAGS -Iinclude/ $LIBRARY bench/parse_bench.c -o parse_bench
+gcc $FLAGS -Iinclude/ $LIBRARY bench/cache_bench.c -o cache_bench
+gcc $FLAGS -Iinclude/ $LIBRARY bench/server_bench.c -o server_bench
+gcc $FLAGS -Iinclude/ $LIBRARY bench/sim_bench.c -o sim_bench
+gcc $FLAGS -Iinclude/ src/err_exit.c tools/trace_decode.c -o trace_decode
+
+# NOTE(ariel) The library exports only the functions of its public header.
+# Its objects link into one first, so calls between them resolve, and then
+# every hidden symbol turns local, so the archive defines no internal names
+# that could clash with those of the application.
+mkdir -p build
+OBJECTS=""
+for source in $LIBRARY; do
+    object="build/$(basename "$source" .c).o"
+    gcc $FLAGS -fPIC -fvisibility=hidden -Iinclude/ -c "$source" -o "$object"
+    OBJECTS="$OBJECTS $object"
+done
+ld -r $OBJECTS -o build/libdnsresolver.o
+objcopy --localize-hidden build/libdnsresolver.o
+rm -f libdnsresolver.a
+ar rcs libdnsresolver.a build/libdnsresolver.o
+gcc -shared -pthread build/libdnsresolver.o -o libdnsresolver.so
+gcc $FLAGS -Iinclude/ examples/epoll.c libdnsresolver.a -o epoll_example
+
+if [ $FUZZ -eq 1 ]; then
+    if command -v clang >/dev/null; then
+        clang -g -O1 -fsanitize=fuzzer,address,undefined -Iinclude/ $LIBRARY fuzz/parse_fuzz.c -o parse_fuzz
+    else
+        gcc -g -O1 -fsanitize=address,undefined -DFUZZ_STANDALONE -Iinclude/ $LIBRARY fuzz/parse_fuzz.c -o parse_fuzz
+    fi
+fi
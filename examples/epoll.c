@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/epoll.h>
+
+#include "dnsresolver.h"
+
+// NOTE(ariel) This program shows how an application embeds the library in an
+// event loop of its own. It resolves every name on its command line at once
+// and prints each answer as it arrives.
+
+static int pending;
+
+static void
+print_result(void *user, const DNS_Result *result)
+{
+    (void)user;
+    --pending;
+
+    if (result->status != DNS_OK) {
+        fprintf(stderr, "%s: %s\n", result->name, dns_status_string(result->status));
+        return;
+    }
+    if (result->rcode) {
+        fprintf(stderr, "%s: rcode %u\n", result->name, result->rcode);
+        return;
+    }
+    for (uint32_t i = 0; i < result->count; ++i) {
+        const DNS_Record *rr = &result->records[i];
+        printf("(%s) %s %s ttl %u\n", dns_type_to_string(rr->type), rr->owner, rr->data, rr->ttl);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [-TYPE] hostname...\n", argv[0]);
+        exit(1);
+    }
+
+    DNS_Context *ctx = dns_context_create();
+    if (!ctx) {
+        fprintf(stderr, "failed to create context of resolver\n");
+        exit(1);
+    }
+
+    int epfd = epoll_create1(0);
+    struct epoll_event event = { .events = EPOLLIN };
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, dns_context_fd(ctx), &event) == -1) {
+        perror("epoll");
+        exit(1);
+    }
+
+    uint16_t type = dns_type_from_string("A");
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            type = dns_type_from_string(argv[i] + 1);
+            if (!type) fprintf(stderr, "unsupported type of resource record %s\n", argv[i] + 1);
+            continue;
+        }
+        if (!type) continue;
+
+        ++pending;
+        DNS_Status status = resolve_async(ctx, argv[i], type, print_result, 0);
+        if (status != DNS_OK) {
+            --pending;
+            fprintf(stderr, "%s: %s\n", argv[i], dns_status_string(status));
+        }
+    }
+
+    while (pending) {
+        struct epoll_event events[1];
+        if (epoll_wait(epfd, events, 1, dns_context_timeout(ctx)) == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(1);
+        }
+        dns_context_process(ctx);
+    }
+
+    dns_context_destroy(ctx);
+    exit(0);
+}
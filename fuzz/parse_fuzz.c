@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "str.h"
+
+// NOTE(ariel) libFuzzer target for the parser of DNS replies. Build it with
+// `./compile.sh --fuzz` and seed it with the corpus that `parse_bench -o dir`
+// writes. Without libFuzzer, define FUZZ_STANDALONE to replay files given as
+// arguments through the same entry point.
+//
+// Every input starts with an empty table of names, so names interned by one
+// input neither pile up over a long run nor change how the next one parses.
+
+global bool initialized = false;
+
+int
+LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+    if (!initialized) {
+        arena_init(&g_arena);
+        initialized = true;
+    }
+    intern_init(&g_names);
+
+    String buf = {
+        .str = (u8 *)data,
+        .len = size,
+    };
+
+    DNS_Reply reply = {0};
+    (void)parse_reply(&reply, buf);
+    arena_clear(&g_arena);
+    intern_release(&g_names);
+
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int
+main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) err_exit("failed to open %s", argv[i]);
+
+        u8 buf[UINT16_MAX] = {0};
+        size_t len = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+
+    exit(0);
+}
+#endif
@@ -12,7 +12,8 @@ typedef struct {
     size_t curr;
 } Arena;
 
-extern Arena g_arena;
+// NOTE(ariel) Each thread owns its own default arena.
+extern _Thread_local Arena g_arena;
 
 void arena_init(Arena *arena);
 void arena_release(Arena *arena);
@@ -0,0 +1,61 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include "common.h"
+#include "output.h"
+
+// NOTE(ariel) Bulk mode resolves every name of a list, one per line, and
+// streams the results through an output writer. It keeps up to `concurrency`
+// resolutions in flight on a single resolver, so it needs a single thread.
+//
+// Memory stays flat however long the list. A regular file is mapped and read
+// in place, and its pages are released once consumed; any other input, e.g.
+// a pipe, is read in chunks. Lines are views into the input that live only
+// until their names are interned. Whatever a resolution allocates from the
+// arena goes away at the end of the turn of the event loop that wrote its
+// result. The names interned and the records cached grow with every new
+// name, so once the table of names holds `BULK_NAME_LIMIT` of them, bulk mode
+// stops to admit new names, lets those in flight finish, and starts over with
+// an empty table and cache.
+//
+// In reverse mode, each line holds an IPv4 or IPv6 address or a range of
+// them in CIDR notation, and bulk mode resolves the name of type PTR under
+// in-addr.arpa or ip6.arpa of every address, built from its bytes directly.
+// A range expands to at most 2^`BULK_RANGE_BITS` addresses. Addresses of a
+// range share the zones of reverse DNS above them, so the first address of a
+// range, and of each /24 of an IPv4 range, resolves alone; the addresses that
+// follow it then start from the delegations it cached instead of all walking
+// down from the root at once. Up to `BULK_BLOCK_LIMIT` such blocks prime at
+// once, so the addresses of one block keep starting while the next waits for
+// its primer, and a primer holds back its block for `BULK_PRIME_MS` at most.
+//
+// With `window` set, results come out in the order of the input. A name
+// enters only once its result fits in the reorder window, and nothing enters
+// while the writer blocks, so neither a slow resolution nor a slow reader of
+// the output lets memory grow.
+
+enum {
+    BULK_CONCURRENCY    = 1000,
+    BULK_NAME_LIMIT     = 1 << 19,
+    BULK_CHUNK_SIZE     = MB(1),
+    BULK_RELEASE_SIZE   = MB(16),
+    BULK_CACHE_CAPACITY = 1 << 16,
+    BULK_CACHE_LIMIT    = MB(32),
+    BULK_RANGE_BITS     = 24,
+    BULK_BLOCK_LIMIT    = 16,
+    BULK_PRIME_MS       = 500,
+};
+
+typedef struct {
+    char *input;   // NOTE(ariel) A path, or "-" for the standard input.
+    u16 qtype;
+    u32 concurrency;
+    u32 window;
+    Output_Format format;
+    bool reverse;
+} Bulk_Config;
+
+// NOTE(ariel) Exit if the input fails to open or read.
+void bulk_run(Bulk_Config config);
+
+#endif
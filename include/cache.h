@@ -0,0 +1,114 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "intern.h"
+
+// NOTE(ariel) A cache belongs to a single thread and maps an interned name and
+// a type to the records of an answer. It never outgrows a ceiling of memory:
+// records live in blocks of a few size classes, carved from slabs of the
+// arena of the cache and recycled through free lists. Once no slab fits
+// under the ceiling or the table holds as many entries as it may, the
+// cache evicts entries in CLOCK order to make room.
+//
+// An entry survives one pass of the hand if it was read since the last one,
+// unless it expires soon anyway. Expired entries go first.
+
+enum {
+    // NOTE(ariel) Type zero is reserved, so it serves as the key of the
+    // address of a nameserver for a zone, i.e. a delegation.
+    CACHE_TYPE_DELEGATION = 0,
+
+    CACHE_SLAB_SIZE = KB(64),
+    CACHE_BLOCK_MIN_SHIFT = 6,
+    CACHE_SIZE_CLASS_COUNT = 7,   // NOTE(ariel) Blocks of 64 to 4096 bytes.
+    CACHE_GRACE_SECONDS = 5,
+};
+
+typedef struct {
+    Name_ID name;
+    u16 type;
+    u16 rcode;
+    u16 count;
+    u8 size_class;
+    bool referenced;
+    u64 expires;
+    Resource_Record *rrs;
+} Cache_Entry;
+
+typedef struct {
+    Arena arena;
+    Cache_Entry *entries;
+    u32 mask;
+    u32 count;
+    u32 capacity;
+    u32 hand;
+
+    size_t limit;
+    size_t committed;
+    size_t payload;
+    void *free[CACHE_SIZE_CLASS_COUNT];
+} Cache;
+
+typedef struct {
+    u32 entries;
+    size_t committed;
+    size_t payload;
+} Cache_Usage;
+
+// NOTE(ariel) The cache that `resolve()` consults on the current thread, if
+// any.
+extern _Thread_local Cache *t_cache;
+
+void cache_init(Cache *c, u32 capacity, size_t limit);
+void cache_release(Cache *c);
+Cache_Usage cache_usage(Cache *c);
+
+bool cache_lookup(Cache *c, Name_ID name, u16 type, u16 *rcode, Resource_Record_Array *rs);
+void cache_insert(Cache *c, Name_ID name, u16 type, u16 rcode, Resource_Record_Array rs, u32 ttl);
+
+// NOTE(ariel) The shared cache serves all threads at once. IDs of names mean
+// nothing outside the thread that interned them, so a slot holds the name and
+// its records in wire form, inline and of fixed size, and a lookup parses
+// them back into the tables of the reader.
+//
+// Every slot carries a sequence number that doubles as a seqlock. Readers
+// never write to a slot: they copy it and retry if its sequence changed or
+// was odd, i.e. a writer held it, in the meantime. A writer claims a single
+// slot by making its sequence odd with a compare-and-swap and gives up at
+// once if another writer holds it, so no thread ever waits on a lock.
+
+enum {
+    SHARED_CACHE_WAYS = 4,
+    SHARED_CACHE_DATA_LIMIT = 480,
+};
+
+typedef struct {
+    u32 seq;
+    u16 type;
+    u16 rcode;
+    u16 count;
+    u16 len;
+    u64 hash;
+    u64 expires;
+    u8 data[SHARED_CACHE_DATA_LIMIT];
+} Shared_Cache_Slot;
+
+typedef struct {
+    Shared_Cache_Slot *slots;
+    u32 mask;
+} Shared_Cache;
+
+// NOTE(ariel) The shared cache that `resolve()` consults after the cache of
+// the current thread, if any.
+extern Shared_Cache *g_shared_cache;
+
+void shared_cache_init(Shared_Cache *c, u32 capacity);
+void shared_cache_release(Shared_Cache *c);
+
+bool shared_cache_lookup(Shared_Cache *c, Name_ID name, u16 type, u16 *rcode, Resource_Record_Array *rs);
+void shared_cache_insert(Shared_Cache *c, Name_ID name, u16 type, u16 rcode, Resource_Record_Array rs, u32 ttl);
+
+#endif
@@ -4,6 +4,8 @@
 #include <sys/socket.h>
 
 #include "common.h"
+#include "dnsresolver.h"
+#include "intern.h"
 #include "str.h"
 
 
@@ -21,8 +23,31 @@ enum {
     DNS_HEADER_LIMIT = 12,
     DNS_DOMAIN_LIMIT = 256,
     DNS_PORT         = 0x3500u,   // NOTE(ariel) Define standard DNS port in network byte order.
+    DNS_HOP_LIMIT    = 32,
+    DNS_DEPTH_LIMIT  = 8,
+
+    // NOTE(ariel) Send a query up to three times, 400 ms apart, and abandon
+    // a resolution that takes longer than five seconds altogether.
+    DNS_TRANSMIT_LIMIT = 3,
+    DNS_RETRANSMIT_MS  = 400,
+    DNS_RESOLUTION_MS  = 5000,
+
+    // NOTE(ariel) Bound the resolutions in flight per resolver, so the IDs of
+    // their transmissions always fit in the 16 bits of the header.
+    DNS_ACTIVE_LIMIT   = 16384,
 };
 
+extern char *DNS_STATUS_STRING[];
+
+typedef enum {
+    DNS_RCODE_NOERROR  = 0,
+    DNS_RCODE_FORMERR  = 1,
+    DNS_RCODE_SERVFAIL = 2,
+    DNS_RCODE_NXDOMAIN = 3,
+    DNS_RCODE_NOTIMP   = 4,
+    DNS_RCODE_REFUSED  = 5,
+} DNS_Rcode;
+
 typedef enum {
     DNS_HEADER_FLAG_QR = 0x8000,
     DNS_HEADER_MASK_OP = 0x7800,
@@ -40,31 +65,61 @@ typedef enum {
     RR_TYPE_A      = 1,
     RR_TYPE_NS     = 2,
     RR_TYPE_CNAME  = 5,
+    RR_TYPE_SOA    = 6,
+    RR_TYPE_PTR    = 12,
+    RR_TYPE_MX     = 15,
+    RR_TYPE_TXT    = 16,
     RR_TYPE_AAAA   = 28,
+    RR_TYPE_SRV    = 33,
 } RR_Type;
 
 extern char *RR_TYPE_STRING[];
 
+// NOTE(ariel) Records keep their rdata in decoded, fixed-size form wherever
+// the type allows it, so a record is a flat value that copies with a single
+// `memcpy()`. Names within rdata are interned. Only TXT records and types the
+// parser does not know point to raw rdata, which remains in the buffer of the
+// received message.
+typedef union {
+    u8 a[4];
+    u8 aaaa[16];
+    Name_ID name;   // NOTE(ariel) NS, CNAME and PTR.
+    struct {
+        u16 preference;
+        Name_ID exchange;
+    } mx;
+    struct {
+        u16 priority;
+        u16 weight;
+        u16 port;
+        Name_ID target;
+    } srv;
+    struct {
+        Name_ID mname;
+        Name_ID rname;
+        u32 serial;
+        u32 refresh;
+        u32 retry;
+        u32 expire;
+        u32 minimum;
+    } soa;
+    u8 *raw;
+} Resource_Record_Data;
+
 typedef struct {
-    String name;
+    Name_ID owner;
     u16 type;
     u16 class;
     i32 ttl;
     u16 rdlength;
-    u8 *rdata;
+    Resource_Record_Data rdata;
 } Resource_Record;
 
-typedef struct Resource_Record_Link {
-    struct Resource_Record_Link *next;
-    Resource_Record rr;
-} Resource_Record_Link;
-
+// NOTE(ariel) Records of one section of a message in the order they appear.
 typedef struct {
-    Resource_Record_Link *A;
-    Resource_Record_Link *NS;
-    Resource_Record_Link *CNAME;
-    Resource_Record_Link *AAAA;
-} Resource_Record_List;
+    Resource_Record *rrs;
+    u32 count;
+} Resource_Record_Array;
 
 typedef struct {
     u16 id;
@@ -77,6 +132,8 @@ typedef struct {
 
 typedef struct {
     String domain;
+    String wire;   // NOTE(ariel) The name as it appears in the message, case included.
+    Name_ID name;
     u16 qtype;
     u16 qclass;
 } DNS_Question;
@@ -84,15 +141,97 @@ typedef struct {
 typedef struct {
     DNS_Header header;
     DNS_Question question;
-    Resource_Record_List answer;
-    Resource_Record_List authority;
-    Resource_Record_List additional;
+    Resource_Record_Array answer;
+    Resource_Record_Array authority;
+    Resource_Record_Array additional;
 } DNS_Message;
 typedef DNS_Message DNS_Query;
 typedef DNS_Message DNS_Reply;
 
+// NOTE(ariel) Query in wire format, encoded once per resolution. Sending it
+// only requires to copy it and to write a new ID and flags into its header.
+typedef struct {
+    u8 buf[UDP_MSG_LIMIT];
+    u16 len;
+    u16 flags;
+    u16 qtype;
+    Name_ID name;
+} Query_Template;
+
+
+// NOTE(ariel) Outcome of a resolution. A status other than `DNS_OK` means
+// the resolver failed to reach an authoritative answer; otherwise `rcode`
+// holds the code of the authoritative reply.
+typedef struct {
+    DNS_Status status;
+    u16 rcode;
+    Resource_Record_Array answer;
+} Resolution;
+
+
+bool parse_reply(DNS_Reply *reply, String buf);
+size_t format_response(u8 *buf, size_t cap, DNS_Query *query, Resolution *resolution);
+
+// NOTE(ariel) Serialize records without compression, so they carry no
+// interned names and parse back in any thread.
+size_t format_records(u8 *buf, size_t cap, Resource_Record_Array rs);
+bool parse_records(Resource_Record_Array *rs, u32 count, String buf);
+
+u16 rr_type_from_string(String s);
+char *rr_type_to_string(u16 type);
+bool rr_rdata_is_raw(u16 type);
+// NOTE(ariel) Return false, along with an empty string, if the rdata fails to
+// format.
+bool format_rdata(String *rdata, Resource_Record *rr);
+
+// NOTE(ariel) Intern the name under in-addr.arpa or ip6.arpa that maps an
+// address of the family back to names, e.g. for a query of type PTR.
+Name_ID reverse_name(int family, u8 *addr);
+
+// NOTE(ariel) A resolver drives any number of resolutions at once over a
+// small pool of nonblocking sockets and reports each outcome to its callback.
+// The caller waits for input on `resolver_fd()`, for at most
+// `resolver_timeout()` nanoseconds, and then calls `resolver_process()`. A
+// resolver belongs to the thread that created it, whose arena, names and
+// caches it uses.
+typedef struct Resolver Resolver;
+typedef void (*Resolve_Callback)(void *user, Resolution *resolution);
+
+// NOTE(ariel) The transport carries the messages of a resolver, keeps its
+// time and draws the IDs of its queries. By default a resolver sends
+// datagrams over sockets of its own on random ports, reads the monotonic
+// clock and draws IDs from the CSPRNG of the kernel, but a transport may as
+// well simulate a network in process along with a virtual clock and a seeded
+// generator, in which case it has no descriptor.
+// Addresses are plain IPv4 or IPv6 addresses, never IPv4 mapped into IPv6.
+typedef struct Transport Transport;
+struct Transport {
+    int fd;
+    bool (*send)(Transport *t, u8 *msg, size_t len, sockaddr_storage *to);
+    // NOTE(ariel) Return the length of the next message received, or -1 if no
+    // message awaits.
+    ssize_t (*recv)(Transport *t, u8 *buf, size_t cap, sockaddr_storage *from);
+    u64 (*now)(Transport *t);
+    // NOTE(ariel) Return false if no ID is available, e.g. the CSPRNG fails.
+    bool (*id)(Transport *t, u16 *id);
+};
 
-Resource_Record_List resolve(String domain);
-void output_address(Resource_Record_List rs);
+Resolver *resolver_create(void);
+Resolver *resolver_create_on(Transport *transport);
+void resolver_destroy(Resolver *r);
+DNS_Status resolver_start(Resolver *r, Name_ID name, u16 qtype, Resolve_Callback callback, void *user);
+int resolver_fd(Resolver *r);
+i64 resolver_timeout(Resolver *r);
+void resolver_process(Resolver *r);
+
+// NOTE(ariel) Wait this long for a reply before the next transmission, which
+// is `DNS_RETRANSMIT_MS` by default.
+void resolver_set_retransmit(Resolver *r, u64 ns);
+
+// NOTE(ariel) Resolve a single name and block until it completes, on a
+// resolver private to the calling thread. Release it before the thread exits.
+Resolution resolve(String domain, u16 qtype);
+void resolve_release(void);
+void output_answer(Resource_Record_Array rs);
 
 #endif
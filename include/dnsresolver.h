@@ -0,0 +1,88 @@
+#ifndef DNSRESOLVER_H
+#define DNSRESOLVER_H
+
+#include <stdint.h>
+
+// NOTE(ariel) Public interface of libdnsresolver, which resolves names
+// iteratively from the root without blocking the caller. A context owns a few
+// sockets and all the state of its resolutions. The application watches the
+// descriptor of the context in its own event loop, e.g. with epoll, and calls
+// `dns_context_process()` whenever the descriptor becomes readable or the
+// timeout the context reports elapses. Every resolution ends in exactly one
+// call of its callback from within the library.
+//
+// A context is not safe to share between threads; use one per thread.
+
+#if defined(__GNUC__)
+#   define DNS_API __attribute__((visibility("default")))
+#else
+#   define DNS_API
+#endif
+
+typedef enum {
+    DNS_OK,
+    DNS_ERR_INVALID_NAME,
+    DNS_ERR_NETWORK,
+    DNS_ERR_TIMEOUT,
+    DNS_ERR_MALFORMED,
+    DNS_ERR_NO_NAMESERVER,
+    DNS_ERR_HOP_LIMIT,
+    DNS_ERR_BUSY,
+    DNS_STATUS_COUNT,
+} DNS_Status;
+
+// NOTE(ariel) Records in presentation form, e.g. "192.0.2.1" for an A record
+// or "10 mail.example.com" for an MX record. Data that fails to format is
+// empty.
+typedef struct {
+    const char *owner;
+    uint16_t type;
+    uint32_t ttl;
+    const char *data;
+} DNS_Record;
+
+// NOTE(ariel) A status other than `DNS_OK` means the resolution failed before
+// it reached an authoritative answer. Otherwise `rcode` holds the code of the
+// authoritative reply, e.g. 3 for a name that does not exist. Every pointer
+// remains valid only until the callback returns.
+typedef struct {
+    const char *name;
+    uint16_t type;
+    DNS_Status status;
+    uint16_t rcode;
+    uint32_t count;
+    const DNS_Record *records;
+} DNS_Result;
+
+typedef void (*DNS_Callback)(void *user, const DNS_Result *result);
+
+typedef struct DNS_Context DNS_Context;
+
+// NOTE(ariel) Return null if the context fails to allocate memory or to open
+// its sockets. Destroying a context abandons its resolutions in flight without
+// calling their callbacks.
+DNS_API DNS_Context *dns_context_create(void);
+DNS_API void dns_context_destroy(DNS_Context *ctx);
+
+// NOTE(ariel) Start to resolve `name`. The callback may run before this
+// function returns, e.g. if the answer is cached. Any other status than
+// `DNS_OK` means the resolution never started and its callback never runs.
+DNS_API DNS_Status resolve_async(DNS_Context *ctx, const char *name, uint16_t type,
+        DNS_Callback callback, void *user);
+
+// NOTE(ariel) The descriptor to watch for input, and the number of
+// milliseconds until the context must process its timers even without any
+// input, or -1 if it awaits none. Callbacks run from within
+// `dns_context_process()`, which never blocks.
+DNS_API int dns_context_fd(DNS_Context *ctx);
+DNS_API int dns_context_timeout(DNS_Context *ctx);
+DNS_API void dns_context_process(DNS_Context *ctx);
+
+DNS_API const char *dns_status_string(DNS_Status status);
+
+// NOTE(ariel) Return the code of a type of record from its name, e.g. 28 for
+// "AAAA", or zero if the library does not know the type.
+DNS_API uint16_t dns_type_from_string(const char *type);
+DNS_API const char *dns_type_to_string(uint16_t type);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "common.h"
+
+// NOTE(ariel) Grace periods for structures that threads read without locks
+// while a single writer replaces them whole. A reader enters the epoch before
+// it loads the published pointer and exits once it no longer touches what the
+// pointer leads to. The writer swaps in the replacement and then waits out
+// the readers before it frees the old structure.
+//
+// Readers count themselves under the parity of the current epoch. The writer
+// moves to the next epoch and waits until the readers of the previous parity
+// drain, then does the same once more for the other parity, so every reader
+// that may have loaded the old pointer has exited while readers that arrive
+// in the meantime never hold it up for long. A reader costs two atomic
+// additions.
+
+typedef struct {
+    u64 epoch;
+    _Alignas(64) i64 readers[2];
+} Epoch;
+
+u32 epoch_enter(Epoch *e);
+void epoch_exit(Epoch *e, u32 parity);
+
+// NOTE(ariel) Return once no reader that entered before the call remains.
+// Publish the replacement first.
+void epoch_wait(Epoch *e);
+
+#endif
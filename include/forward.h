@@ -0,0 +1,45 @@
+#ifndef FORWARD_H
+#define FORWARD_H
+
+#include "common.h"
+#include "dns.h"
+
+// NOTE(ariel) In forwarding mode the resolver does not iterate from the root
+// itself. It sends every query with the flag RD set to one upstream of a pool
+// of recursive resolvers and takes the first usable reply as the answer.
+//
+// Every thread shares the state of the pool: the queries outstanding at each
+// upstream, a smoothed RTT and a count of consecutive failures. A policy picks
+// the upstream for each transmission, and a retransmission goes to another
+// upstream than the ones a resolution already tried, so a dead upstream costs
+// a resolution one retransmission at most. An upstream that fails too many
+// times in a row counts as down until a reply arrives from it again; a thread
+// of its own probes every upstream once per second to find out.
+
+enum { FORWARD_UPSTREAM_LIMIT = 16 };
+
+typedef enum {
+    FORWARD_ROUND_ROBIN,
+    FORWARD_LEAST_OUTSTANDING,
+    FORWARD_FASTEST,
+    FORWARD_POLICY_COUNT,
+} Forward_Policy;
+
+// NOTE(ariel) Parse upstreams of the form `address[#port]` and start to probe
+// them, or exit. Configuring the pool alone skips the probes, e.g. for upstreams
+// on a simulated network, and resets the state of any previous pool.
+void forward_init(char **upstreams, u32 count, Forward_Policy policy);
+void forward_configure(char **upstreams, u32 count, Forward_Policy policy);
+Forward_Policy forward_policy_from_string(char *s);
+bool forward_enabled(void);
+
+// NOTE(ariel) Pick an upstream for a transmission, avoiding the upstreams in
+// the bitmask `tried` if possible, and count it as outstanding until released.
+i32 forward_pick(u32 tried, sockaddr_storage *addr);
+sockaddr_storage *forward_addr(i32 upstream);
+void forward_release(i32 upstream);
+
+void forward_success(i32 upstream, u64 rtt);
+void forward_failure(i32 upstream);
+
+#endif
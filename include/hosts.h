@@ -0,0 +1,36 @@
+#ifndef HOSTS_H
+#define HOSTS_H
+
+#include "common.h"
+#include "dns.h"
+#include "intern.h"
+
+// NOTE(ariel) Local overrides answer names from files instead of from the
+// Internet. A file holds lines of two kinds: lines of a hosts file, i.e. an
+// address followed by names, and lines of a simple zone, i.e. a fully
+// qualified name, optionally a TTL and the class IN, then a type and its
+// rdata. A hosts line also maps its address back to its names through PTR
+// records. Once a name appears in any file, the overrides answer every type
+// of query for it: with its CNAME records for a type the files omit, and
+// otherwise with no records at all.
+//
+// The overrides live in a table that never changes once built, indexed by a
+// minimal perfect hash in the style of CHD (hash, displace and compress): a
+// name hashes to a bucket, and a displacement per bucket leads every name of
+// the bucket to a slot of its own, which holds its records of every type.
+// Finding a name costs two hashes and one comparison of names. Its records
+// then decode into the arena of the calling thread, since each thread interns
+// the names of their rdata into its own table. SIGHUP rebuilds the table from
+// the same files and swaps it in whole, and frees the old one once no lookup
+// still reads it.
+
+enum { HOSTS_FILE_LIMIT = 16 };
+
+// NOTE(ariel) Build the table or exit. This blocks SIGHUP in the calling
+// thread, so call it before any other thread starts; threads inherit the
+// mask, and a thread of its own then waits for the signal.
+void hosts_init(char **paths, u32 count);
+
+bool hosts_lookup(Name_ID name, u16 qtype, Resolution *resolution);
+
+#endif
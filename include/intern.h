@@ -0,0 +1,51 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "arena.h"
+#include "common.h"
+#include "str.h"
+
+// NOTE(ariel) The table stores each distinct domain name once, in canonical
+// (lowercase) wire form alongside its presentation form, and identifies it by
+// a small integer. Two names are equal if and only if their IDs are equal.
+// Names never move once interned, so the strings returned remain valid for
+// the lifetime of the table.
+
+typedef u32 Name_ID;
+
+enum { NAME_ID_NONE = 0 };
+
+typedef struct {
+    String wire;
+    String text;
+    u64 hash;
+} Interned_Name;
+
+typedef struct {
+    Arena strings;
+    Arena entries;
+    Arena slots;
+
+    Interned_Name *names;
+    u32 count;
+
+    u32 *table;
+    u32 mask;
+} Intern_Table;
+
+// NOTE(ariel) Each thread interns names into its own table, so IDs are only
+// meaningful within the thread that created them.
+extern _Thread_local Intern_Table g_names;
+
+void intern_init(Intern_Table *t);
+void intern_release(Intern_Table *t);
+
+Name_ID intern_wire(Intern_Table *t, String wire);
+Name_ID intern_find_wire(Intern_Table *t, String wire);
+Name_ID intern_text(Intern_Table *t, String text);
+
+String intern_lookup_wire(Intern_Table *t, Name_ID id);
+String intern_lookup_text(Intern_Table *t, Name_ID id);
+u64 intern_lookup_hash(Intern_Table *t, Name_ID id);
+
+#endif
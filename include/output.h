@@ -0,0 +1,81 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <sys/uio.h>
+
+#include "common.h"
+#include "dns.h"
+#include "str.h"
+
+// NOTE(ariel) Streaming writer of results in machine-readable form. It writes
+// every record of an answer along with its TTL, and the status of the
+// resolution, in one of three formats:
+//
+// - JSONL: one object per resolution, e.g.
+//   {"name":"example.com","type":"A","status":"ok","rcode":"NOERROR",
+//    "answers":[{"owner":"example.com","type":"A","ttl":300,"data":"192.0.2.1"}]}
+// - CSV: a header, then one row per record or a single row with empty record
+//   fields for a resolution without any.
+// - Binary: the magic "DNSO" and a version of 16 bits, then per resolution
+//   and in network byte order the length of the rest of the entry (32 bits),
+//   the type (16), the status (8), the rcode (8) and the number of records
+//   (16), then the name as text after its length (8), and the records in
+//   uncompressed wire form, so `parse_records()` reads them back.
+//
+// Results accumulate in chunks of a large buffer that go out together in a
+// single `writev()` once all of them fill up. With a reorder window of `n`,
+// results may arrive out of order as long as each one falls within the `n`
+// results that follow the last one written, and the writer holds them back
+// until those before them arrive. A window of zero writes results as they
+// come.
+
+enum {
+    OUTPUT_CHUNK_SIZE  = KB(256),
+    OUTPUT_CHUNK_COUNT = 8,
+    OUTPUT_VERSION     = 1,
+};
+
+typedef enum {
+    OUTPUT_JSONL,
+    OUTPUT_CSV,
+    OUTPUT_BINARY,
+    OUTPUT_FORMAT_COUNT,
+} Output_Format;
+
+typedef struct {
+    u8 *buf;
+    size_t len;
+    size_t cap;
+    bool ready;
+} Output_Buffer;
+
+typedef struct {
+    int fd;
+    Output_Format format;
+
+    u8 *chunks;
+    struct iovec iov[OUTPUT_CHUNK_COUNT];
+    u32 chunk;
+
+    u32 window;
+    u64 next;
+    Output_Buffer *pending;
+    Output_Buffer scratch;
+} Output;
+
+Output_Format output_format_from_string(char *s);
+
+// NOTE(ariel) Exit if any allocation or write fails.
+void output_init(Output *o, int fd, Output_Format format, u32 window);
+void output_release(Output *o);
+
+// NOTE(ariel) Whether the result numbered `seq` fits in the reorder window.
+bool output_admits(Output *o, u64 seq);
+
+// NOTE(ariel) Format the result numbered `seq`, counting from zero, for a name
+// in presentation form, which need not be valid. Formatting takes memory from
+// `g_arena` and reads the names of records from `g_names`.
+void output_write(Output *o, u64 seq, String name, u16 qtype, Resolution *resolution);
+void output_flush(Output *o);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef ROOT_H
+#define ROOT_H
+
+#include "common.h"
+#include "dns.h"
+#include "str.h"
+
+// NOTE(ariel) Local copy of the root zone in the style of RFC 8806. The
+// resolver loads the delegations of the root, i.e. the nameservers of every
+// TLD and their addresses, from a zone file into an index sorted by TLD, and
+// takes the referral for a name from there instead of from a root server.
+//
+// A zone never changes once loaded. A thread watches the file and, when a
+// new one replaces it, loads the new zone in full before it swaps the pointer
+// that resolutions read, so a resolution sees either the old zone or the new
+// one and never blocks. The old zone goes once no resolution still reads it.
+
+typedef enum {
+    ROOT_ZONE_MISS,       // NOTE(ariel) No zone, or no address to refer to.
+    ROOT_ZONE_REFERRAL,
+    ROOT_ZONE_NXDOMAIN,   // NOTE(ariel) The TLD of the name does not exist.
+} Root_Zone_Answer;
+
+// NOTE(ariel) Load the zone at `path` or exit, then watch it for changes.
+void root_zone_init(char *path);
+
+// NOTE(ariel) Find the nameservers of the TLD of a name in wire form and
+// return the address of one of them along with its name.
+Root_Zone_Answer root_zone_refer(String wire, sockaddr_storage *addr, String *ns);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+
+#include "common.h"
+
+// NOTE(ariel) The server runs one worker per core. Each worker binds its own
+// socket to the same port with SO_REUSEPORT, so the kernel spreads queries
+// across workers, and each owns its arena, interned names, statistics and
+// shard of the cache. Workers share no state while they answer queries,
+// unless `share` asks them to also publish to and consult a shared cache,
+// which lets one worker answer from what another resolved.
+//
+// Each worker drives its own resolver in an event loop alongside its socket,
+// so it takes in and answers other queries while resolutions await replies
+// from nameservers. A client that repeats a query in flight, i.e. from the
+// same address with the same ID, waits for the same resolution.
+//
+// Every new name grows the table of names of a worker, which its cache keys
+// entries by. Once the table holds `SERVER_NAME_LIMIT` names, the worker
+// lets the queries in flight finish and starts over with an empty table and
+// cache, so its memory stays bounded however many names clients ask for.
+
+enum {
+    SERVER_NAME_LIMIT = 1 << 19,
+};
+
+typedef struct {
+    u16 port;
+    u32 workers;
+    u32 cache_capacity;
+    size_t cache_limit;
+    bool pin;
+    bool share;
+
+    // NOTE(ariel) Optionally prepare the state of each worker, e.g. to warm
+    // its cache, on its own thread before it starts to answer queries.
+    void (*worker_init)(u32 worker);
+} Server_Config;
+
+typedef struct Server Server;
+
+Server *server_start(Server_Config config);
+void server_wait(Server *server);
+void server_stop(Server *server);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "common.h"
+#include "dns.h"
+
+// NOTE(ariel) Simulated network in process, for a resolver to run on instead
+// of real sockets. A virtual clock drives it: time only moves when the driver
+// jumps it to the next event, i.e. the next delivery of a message or the next
+// timer of the resolver, so a run that spans minutes of virtual time takes as
+// long as the work itself and never sleeps. A seed determines every random
+// choice, the IDs of queries included, so the same run always unfolds the
+// same way.
+//
+// Each simulated server sits behind a link of its own. A link loses messages
+// in either direction with some probability, delays each of them by a sample
+// of a distribution of latency, and duplicates replies with some probability.
+// Samples differ from message to message, so messages also arrive out of
+// order. A server may also fail in one of several ways for a window of
+// virtual time, e.g. to take it down in the middle of a run.
+
+enum {
+    SIM_SERVER_LIMIT = 64,
+};
+
+typedef enum {
+    SIM_LATENCY_FIXED,         // NOTE(ariel) Always `latency`.
+    SIM_LATENCY_UNIFORM,       // NOTE(ariel) Between `latency` and `latency + jitter`.
+    SIM_LATENCY_EXPONENTIAL,   // NOTE(ariel) `latency` plus a tail with a mean of `jitter`.
+} Sim_Latency;
+
+typedef enum {
+    SIM_FAILURE_NONE,
+    SIM_FAILURE_SILENT,     // NOTE(ariel) Drop every query.
+    SIM_FAILURE_SERVFAIL,
+    SIM_FAILURE_REFUSED,
+} Sim_Failure;
+
+// NOTE(ariel) Latencies are one way, in nanoseconds of virtual time.
+typedef struct {
+    Sim_Latency distribution;
+    u64 latency;
+    u64 jitter;
+    double loss;
+    double duplicate;
+
+    Sim_Failure failure;
+    u64 failure_start;
+    u64 failure_end;   // NOTE(ariel) Zero means forever.
+} Sim_Link;
+
+// NOTE(ariel) Write the reply to a query into `reply` and return its length,
+// or zero to ignore the query.
+typedef size_t (*Sim_Handler)(void *user, u8 *query, size_t len, u8 *reply, size_t cap);
+
+typedef struct {
+    sockaddr_storage addr;
+    Sim_Link link;
+    Sim_Handler handler;
+    void *user;
+    u64 queries;
+} Sim_Server;
+
+typedef struct Sim_Packet Sim_Packet;
+
+typedef struct {
+    Transport transport;
+    u64 now;
+    u64 random;
+
+    Sim_Server servers[SIM_SERVER_LIMIT];
+    u32 server_count;
+
+    // NOTE(ariel) Messages in flight in a binary heap ordered by the time of
+    // delivery, and by the order of sending among equal times.
+    Sim_Packet *packets;
+    u32 packet_count;
+    u32 packet_cap;
+    u64 order;
+} Sim_Network;
+
+void sim_init(Sim_Network *n, u64 seed);
+void sim_release(Sim_Network *n);
+
+// NOTE(ariel) Add a server that listens on the DNS port of `ip`.
+Sim_Server *sim_add_server(Sim_Network *n, char *ip, Sim_Link link, Sim_Handler handler, void *user);
+
+// NOTE(ariel) Run a resolver on the network until virtual time `until`, or
+// until it has nothing left to do if `until` is `UINT64_MAX`.
+void sim_run(Sim_Network *n, Resolver *r, u64 until);
+
+// NOTE(ariel) Draw a number in [0, 1) from the generator of the network.
+double sim_random(Sim_Network *n);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+// NOTE(ariel) Every thread that resolves names registers its own block of
+// counters and latency histograms, so recording a sample never contends with
+// another thread. Only the thread that owns a block writes to it; a dump
+// reads all blocks and sums them.
+
+typedef enum {
+    STAT_QUERIES_SENT,
+    STAT_TIMEOUTS,
+    STAT_MALFORMED_REPLIES,
+    STAT_REFERRALS,
+    STAT_FAILOVERS,
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_CACHE_EVICTIONS,
+    STAT_ARENA_GROWTHS,
+    STAT_COUNTER_COUNT,
+} Stat_Counter;
+
+typedef enum {
+    STAT_STAGE_SEND,
+    STAT_STAGE_WAIT,
+    STAT_STAGE_PARSE,
+    STAT_STAGE_ITERATE,
+    STAT_STAGE_RESOLVE,
+    STAT_STAGE_COUNT,
+} Stat_Stage;
+
+// NOTE(ariel) Histograms are log-linear in the style of HDR histograms: each
+// power of two of nanoseconds splits into eight buckets of equal width, which
+// bounds the relative error of any recorded latency to 12.5%.
+enum {
+    STAT_SUB_BUCKET_BITS  = 3,
+    STAT_SUB_BUCKET_COUNT = 1 << STAT_SUB_BUCKET_BITS,
+    STAT_BUCKET_COUNT     = 64 * STAT_SUB_BUCKET_COUNT,
+    STAT_THREAD_LIMIT     = 256,
+};
+
+typedef struct {
+    u64 buckets[STAT_BUCKET_COUNT];
+    u64 count;
+    u64 sum;
+} Stat_Histogram;
+
+typedef struct {
+    u64 counters[STAT_COUNTER_COUNT];
+    Stat_Histogram stages[STAT_STAGE_COUNT];
+} Stats;
+
+extern _Thread_local Stats *t_stats;
+
+void stats_init(void);
+void stats_thread_init(void);
+void stats_dump(int fd);
+
+u64 stats_now(void);
+u32 stats_bucket(u64 ns);
+
+// NOTE(ariel) Relaxed stores suffice because each block has a single writer.
+// They compile to plain moves, yet keep concurrent dumps free of torn reads.
+#define STAT_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+internal inline void
+stats_count(Stat_Counter counter)
+{
+    Stats *s = t_stats;
+    if (s) STAT_STORE(&s->counters[counter], s->counters[counter] + 1);
+}
+
+internal inline void
+stats_record(Stat_Stage stage, u64 start)
+{
+    Stats *s = t_stats;
+    if (s) {
+        u64 ns = stats_now() - start;
+        Stat_Histogram *h = &s->stages[stage];
+        u32 bucket = stats_bucket(ns);
+        STAT_STORE(&h->buckets[bucket], h->buckets[bucket] + 1);
+        STAT_STORE(&h->count, h->count + 1);
+        STAT_STORE(&h->sum, h->sum + ns);
+    }
+}
+
+#endif
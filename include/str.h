@@ -12,27 +12,10 @@ typedef struct {
 } String;
 
 bool string_cmp(String s, String t);
+bool string_cmp_nocase(String s, String t);
+size_t string_find(String s, u8 c, size_t start);
+u64 string_hash(String s);
 String string_dup(String s);
 char *string_term(String s);
 
-
-typedef struct String_Node {
-    struct String_Node *next;
-    String string;
-} String_Node;
-
-typedef struct {
-    String_Node *head;
-    String_Node *tail;
-    size_t total_len;
-    size_t list_size;
-} String_List;
-
-void push_string_node(String_List *ls, String_Node *n);
-void push_string(String_List *ls, String s);
-
-String_List string_split(String s, u8 delim);
-String string_list_concat(String_List ls);
-String string_list_join(String_List ls, u8 sep);
-
 #endif
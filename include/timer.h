@@ -0,0 +1,56 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "common.h"
+
+// NOTE(ariel) Hierarchical timing wheel in the style of the classic timers of
+// the Linux kernel. Level `l` holds 64 slots of 64^l ticks each, so four
+// levels of 1 ms ticks span more than four hours. A timer lands in the
+// lowest level whose span covers its deadline and cascades to the level
+// below whenever the wheel crosses into its slot.
+//
+// Timers link into their slot through intrusive pointers, so starting and
+// cancelling one is O(1) and never allocates. A bitmap of occupied slots per
+// level tells the event loop when the wheel next needs to advance.
+
+enum {
+    TIMER_TICK_SHIFT   = 20,   // NOTE(ariel) Ticks of 2^20 ns, i.e. about 1 ms.
+    TIMER_LEVEL_BITS   = 6,
+    TIMER_LEVEL_SLOTS  = 1 << TIMER_LEVEL_BITS,
+    TIMER_LEVEL_MASK   = TIMER_LEVEL_SLOTS - 1,
+    TIMER_LEVEL_COUNT  = 4,
+};
+
+typedef struct Timer Timer;
+struct Timer {
+    Timer *next;
+    Timer *prev;
+    u64 expires;
+    u8 level;
+    u8 slot;
+    bool pending;
+
+    void (*expire)(Timer *timer);
+    void *data;
+};
+
+// NOTE(ariel) A wheel of all zeros is empty and ready to use.
+typedef struct {
+    u64 now;
+    u32 count;
+    u64 occupied[TIMER_LEVEL_COUNT];
+    Timer *slots[TIMER_LEVEL_COUNT][TIMER_LEVEL_SLOTS];
+} Timer_Wheel;
+
+// NOTE(ariel) All times are in nanoseconds of the same monotonic clock, e.g.
+// the one of `stats_now()`. A timer fires in the first call to
+// `timer_advance()` at or after its deadline, rounded up to the next tick.
+void timer_start(Timer_Wheel *w, Timer *timer, u64 now, u64 timeout);
+void timer_cancel(Timer_Wheel *w, Timer *timer);
+void timer_advance(Timer_Wheel *w, u64 now);
+
+// NOTE(ariel) Return the number of nanoseconds until the wheel next needs to
+// advance, or -1 if it holds no timers.
+i64 timer_next(Timer_Wheel *w, u64 now);
+
+#endif
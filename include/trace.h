@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/socket.h>
+
+#include "common.h"
+#include "str.h"
+
+// NOTE(ariel) Trace events of sampled resolutions go to a fixed-size ring of
+// binary records. The ring lives in a file mapped into memory, so a decoder
+// such as `trace_decode` reads it at any time, even while the resolver runs,
+// without any cooperation from the resolver. Writers claim slots with a single
+// atomic increment and guard each slot with a sequence number, so concurrent
+// writers never block one another and a reader detects slots that it catches
+// in the middle of a write.
+
+enum {
+    TRACE_MAGIC        = 0x54534e44,   // NOTE(ariel) "DNST" in little endian.
+    TRACE_VERSION      = 1,
+    TRACE_CAPACITY     = 1 << 14,
+    TRACE_NAME_LIMIT   = 72,
+};
+
+typedef enum {
+    TRACE_RESOLVE_BEGIN = 1,
+    TRACE_QUERY_SENT,
+    TRACE_REPLY_PARSED,
+    TRACE_REPLY_RECEIVED,
+    TRACE_REPLY_MALFORMED,
+    TRACE_TIMEOUT,
+    TRACE_REFERRAL,
+    TRACE_RESOLVE_END,
+} Trace_Event_Type;
+
+typedef enum {
+    TRACE_REASON_NONE,
+    TRACE_REASON_GLUE,
+    TRACE_REASON_GLUELESS,
+    TRACE_REASON_ROOT_ZONE,
+    TRACE_REASON_FORWARD,
+} Trace_Reason;
+
+typedef struct {
+    u32 seq;
+    u8 type;
+    u8 reason;
+    u8 family;
+    u8 name_len;
+    u64 timestamp;
+    u64 resolution;
+    u64 duration;
+    u16 values[4];
+    u8 addr[16];
+    u8 name[TRACE_NAME_LIMIT];
+} Trace_Event;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 capacity;
+    u32 event_size;
+    u64 head;
+    u8 reserved[40];
+} Trace_Header;
+
+typedef struct {
+    u64 resolution;
+    bool sampled;
+} Trace_Span;
+
+// NOTE(ariel) The resolution that the current thread works on. Every event
+// belongs to it, which spares the trace points any extra arguments.
+extern _Thread_local Trace_Span t_trace;
+
+void trace_init(char *path, u32 sample_rate);
+
+Trace_Span trace_begin(String name, u16 qtype);
+void trace_end(Trace_Span previous, u64 start, u16 rcode, u16 answers);
+
+void trace_emit(Trace_Event_Type type, Trace_Reason reason, struct sockaddr_storage *addr,
+        String name, u64 duration, u16 v0, u16 v1, u16 v2, u16 v3);
+
+// NOTE(ariel) Trace points of a resolution that is not sampled reduce to this
+// single branch on a thread-local flag.
+#define TRACE(...) \
+    do { \
+        if (t_trace.sampled) trace_emit(__VA_ARGS__); \
+    } while (0)
+
+#endif
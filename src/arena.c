@@ -3,10 +3,11 @@
 #include <sys/mman.h>
 
 #include "arena.h"
+#include "stats.h"
 
 enum { MEMORY_ALIGNMENT = (sizeof(void *) * 2) };
 
-Arena g_arena = {0};
+_Thread_local Arena g_arena = {0};
 
 void
 arena_init(Arena *arena)
@@ -24,8 +25,10 @@ arena_init(Arena *arena)
 void
 arena_release(Arena *arena)
 {
+    // NOTE(ariel) Unmap the whole reservation, not only the pages committed,
+    // so arenas that come and go leave no address space behind.
     arena_clear(arena);
-    (void)munmap(arena->buf, arena->cap);
+    (void)munmap(arena->buf, GB(4));
 }
 
 internal uintptr_t
@@ -36,6 +39,18 @@ align(uintptr_t p)
     return p;
 }
 
+internal void
+grow(Arena *arena, size_t size)
+{
+    // NOTE(ariel) Commit every page a large allocation needs in one call to
+    // mprotect(2) rather than one page per call.
+    size_t pages = (size + KB(4) - 1) / KB(4);
+    size_t cap = MAX(arena->cap + KB(4), pages * KB(4));
+    if (mprotect(arena->buf, cap, PROT_READ | PROT_WRITE) == -1) abort();
+    arena->cap = cap;
+    stats_count(STAT_ARENA_GROWTHS);
+}
+
 void *
 arena_alloc(Arena *arena, size_t size)
 {
@@ -52,8 +67,7 @@ alloc:
         memset(p, 0, size);
         return p;
     } else {
-        arena->cap += KB(4);
-        if (mprotect(arena->buf, arena->cap, PROT_READ | PROT_WRITE) == -1) abort();
+        grow(arena, offset + size);
         goto alloc;
     }
 
@@ -72,8 +86,7 @@ alloc:
         void *p = &arena->buf[arena->prev];
         return p;
     } else {
-        arena->cap += KB(4);
-        if (mprotect(arena->buf, arena->cap, PROT_READ | PROT_WRITE) == -1) abort();
+        grow(arena, arena->prev + size);
         goto alloc;
     }
 
@@ -0,0 +1,503 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "bulk.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "output.h"
+#include "stats.h"
+#include "str.h"
+
+typedef struct {
+    int fd;
+    bool mapped;
+    bool eof;
+    bool skip;   // NOTE(ariel) Discard the rest of a line too long to hold.
+
+    u8 *buf;
+    size_t len;
+    size_t cursor;
+    size_t released;
+} Bulk_Input;
+
+// NOTE(ariel) The addresses of a range left to resolve, starting at `addr`.
+typedef struct {
+    int family;
+    u8 addr[16];
+    u32 remaining;
+} Bulk_Range;
+
+typedef struct Bulk Bulk;
+typedef struct Bulk_Request Bulk_Request;
+
+// NOTE(ariel) Addresses that share their zones of reverse DNS: a /24 of an
+// IPv4 range, or a whole IPv6 range. Its positions in the output are reserved
+// when it splits off its range, so its addresses may start after those of
+// later blocks and still come out in the order of the input.
+typedef struct {
+    Bulk_Range range;
+    u64 seq;
+    bool prime;   // NOTE(ariel) The next address to start becomes the primer.
+    Bulk_Request *primer;
+    u64 deadline;
+} Bulk_Block;
+
+struct Bulk_Request {
+    Bulk *bulk;
+    Bulk_Request *next;
+    u64 seq;
+    Name_ID name;
+};
+
+struct Bulk {
+    Bulk_Config config;
+    Bulk_Input input;
+    Resolver *resolver;
+    Output output;
+    Cache cache;
+
+    Bulk_Request *requests;
+    Bulk_Request *free;
+    u32 active;
+    u64 seq;
+
+    bool drained;
+
+    // NOTE(ariel) In reverse mode, the rest of the range of the current line,
+    // and the blocks split off it whose addresses have yet to start.
+    Bulk_Range range;
+    Bulk_Block blocks[BULK_BLOCK_LIMIT];
+    u32 block_count;
+};
+
+
+/* ---
+ * Read lines from a mapping or in chunks.
+ * ---
+ */
+
+internal void
+open_input(Bulk_Input *in, char *path)
+{
+    *in = (Bulk_Input){
+        .fd = strcmp(path, "-") ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO,
+    };
+    if (in->fd == -1) err_exit("failed to open %s", path);
+
+    struct stat st = {0};
+    if (fstat(in->fd, &st) == -1) err_exit("failed to stat %s", path);
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        in->buf = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (in->buf == MAP_FAILED) err_exit("failed to map %s", path);
+        (void)madvise(in->buf, st.st_size, MADV_SEQUENTIAL);
+        in->mapped = true;
+        in->eof = true;
+        in->len = st.st_size;
+    } else {
+        in->buf = malloc(BULK_CHUNK_SIZE);
+        if (!in->buf) err_exit("failed to allocate buffer for input");
+    }
+}
+
+internal void
+close_input(Bulk_Input *in)
+{
+    if (in->mapped) munmap(in->buf, in->len);
+    else free(in->buf);
+    if (in->fd != STDIN_FILENO) close(in->fd);
+}
+
+internal void
+release_input(Bulk_Input *in)
+{
+    // NOTE(ariel) Pages of a mapped file count toward the resident set as long
+    // as they stay mapped, so drop those behind the cursor now and then.
+    if (in->cursor - in->released < BULK_RELEASE_SIZE) return;
+    size_t end = in->cursor & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    (void)madvise(in->buf + in->released, end - in->released, MADV_DONTNEED);
+    in->released = end;
+}
+
+internal void
+fill_input(Bulk_Input *in)
+{
+    memmove(in->buf, in->buf + in->cursor, in->len - in->cursor);
+    in->len -= in->cursor;
+    in->cursor = 0;
+
+    for (;;) {
+        ssize_t n = read(in->fd, in->buf + in->len, BULK_CHUNK_SIZE - in->len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) err_exit("failed to read names");
+        if (!n) in->eof = true;
+        in->len += n;
+        return;
+    }
+}
+
+// NOTE(ariel) The line remains valid only until the next call.
+internal bool
+next_line(Bulk_Input *in, String *line)
+{
+    for (;;) {
+        u8 *start = in->buf + in->cursor;
+        size_t avail = in->len - in->cursor;
+        u8 *newline = memchr(start, '\n', avail);
+
+        if (in->skip) {
+            if (newline) {
+                in->cursor += newline - start + 1;
+                in->skip = false;
+            } else {
+                in->cursor = in->len;
+                if (in->eof) return false;
+                fill_input(in);
+            }
+        } else if (newline) {
+            *line = (String){ .str = start, .len = newline - start };
+            in->cursor += line->len + 1;
+            if (in->mapped) release_input(in);
+            return true;
+        } else if (in->eof) {
+            if (!avail) return false;
+            *line = (String){ .str = start, .len = avail };
+            in->cursor = in->len;
+            return true;
+        } else if (!in->cursor && in->len == BULK_CHUNK_SIZE) {
+            // NOTE(ariel) Report the start of the line, which fails as a name.
+            *line = (String){ .str = start, .len = DNS_DOMAIN_LIMIT };
+            in->cursor = in->len;
+            in->skip = true;
+            return true;
+        } else {
+            fill_input(in);
+        }
+    }
+}
+
+internal String
+first_field(String line)
+{
+    size_t i = 0;
+    while (i < line.len && (line.str[i] == ' ' || line.str[i] == '\t')) ++i;
+    size_t start = i;
+    while (i < line.len && line.str[i] != ' ' && line.str[i] != '\t' && line.str[i] != '\r') ++i;
+    return (String){ .str = line.str + start, .len = i - start };
+}
+
+
+/* ---
+ * Expand addresses and ranges of addresses.
+ * ---
+ */
+
+internal bool
+parse_range(String field, Bulk_Range *range)
+{
+    char text[64] = {0};
+    if (field.len >= sizeof(text)) return false;
+    memcpy(text, field.str, field.len);
+
+    u32 prefix = UINT32_MAX;
+    char *slash = strchr(text, '/');
+    if (slash) {
+        *slash = 0;
+        char *end = 0;
+        unsigned long value = strtoul(slash + 1, &end, 10);
+        if (!slash[1] || *end || value > 128) return false;
+        prefix = value;
+    }
+
+    *range = (Bulk_Range){0};
+    u32 bits = 0;
+    if (inet_pton(AF_INET, text, range->addr) == 1) {
+        range->family = AF_INET;
+        bits = 32;
+    } else if (inet_pton(AF_INET6, text, range->addr) == 1) {
+        range->family = AF_INET6;
+        bits = 128;
+    } else {
+        return false;
+    }
+
+    // NOTE(ariel) A prefix longer than the address is no range at all.
+    if (slash && prefix > bits) return false;
+    prefix = MIN(prefix, bits);
+    if (bits - prefix > BULK_RANGE_BITS) return false;
+
+    // NOTE(ariel) Start at the first address of the range whatever the host
+    // part given.
+    for (u32 i = prefix; i < bits; ++i) range->addr[i / 8] &= ~(0x80 >> i % 8);
+    range->remaining = 1u << (bits - prefix);
+    return true;
+}
+
+internal void
+skip_addresses(Bulk_Range *range, u32 count)
+{
+    range->remaining -= count;
+    u32 carry = count;
+    for (i32 i = range->family == AF_INET ? 3 : 15; i >= 0 && carry; --i) {
+        carry += range->addr[i];
+        range->addr[i] = carry;
+        carry >>= 8;
+    }
+}
+
+internal void
+split_block(Bulk *b, Bulk_Block *block)
+{
+    Bulk_Range *range = &b->range;
+    u32 count = range->remaining;
+    if (range->family == AF_INET) count = MIN(count, 256u - range->addr[3]);
+
+    *block = (Bulk_Block){ .range = *range, .seq = b->seq, .prime = count > 1 };
+    block->range.remaining = count;
+    b->seq += count;
+    skip_addresses(range, count);
+}
+
+
+/* ---
+ * Keep a bounded number of resolutions in flight.
+ * ---
+ */
+
+internal void
+write_result(void *user, Resolution *resolution)
+{
+    Bulk_Request *request = user;
+    Bulk *b = request->bulk;
+
+    String name = intern_lookup_text(&g_names, request->name);
+    output_write(&b->output, request->seq, name, b->config.qtype, resolution);
+
+    for (u32 i = 0; i < b->block_count; ++i) {
+        if (b->blocks[i].primer == request) b->blocks[i].primer = 0;
+    }
+    request->next = b->free;
+    b->free = request;
+    --b->active;
+}
+
+// NOTE(ariel) A name that fails to start still takes its place in the output.
+internal void
+start(Bulk *b, u64 seq, Name_ID id, String name, Bulk_Request **primer)
+{
+    DNS_Status status = DNS_ERR_INVALID_NAME;
+    if (id) {
+        Bulk_Request *request = b->free;
+        b->free = request->next;
+        *request = (Bulk_Request){ .bulk = b, .seq = seq, .name = id };
+
+        // NOTE(ariel) Mark the primer before it starts, since an answer from
+        // the cache completes it at once.
+        if (primer) *primer = request;
+
+        ++b->active;
+        status = resolver_start(b->resolver, id, b->config.qtype, write_result, request);
+        if (status) {
+            if (primer) *primer = 0;
+            request->next = b->free;
+            b->free = request;
+            --b->active;
+        }
+    }
+
+    if (status) output_write(&b->output, seq, name, b->config.qtype, &(Resolution){ .status = status });
+}
+
+internal bool
+next_field(Bulk *b, String *field)
+{
+    String line = {0};
+    do {
+        if (!next_line(&b->input, &line)) return false;
+        *field = first_field(line);
+    } while (!field->len || field->str[0] == '#');
+    return true;
+}
+
+internal void
+start_address(Bulk *b, Bulk_Block *block)
+{
+    Bulk_Request **primer = 0;
+    if (block->prime) {
+        block->prime = false;
+        block->deadline = stats_now() + BULK_PRIME_MS * 1000000ull;
+        primer = &block->primer;
+    }
+
+    Name_ID id = reverse_name(block->range.family, block->range.addr);
+    skip_addresses(&block->range, 1);
+    start(b, block->seq++, id, intern_lookup_text(&g_names, id), primer);
+}
+
+// NOTE(ariel) Start the next address of the first block whose primer neither
+// runs nor waits to start, or else split a new block off the range and start
+// its primer, so addresses outside a block keep starting while it waits.
+internal bool
+admit_address(Bulk *b)
+{
+    u64 now = stats_now();
+    for (u32 i = 0; i < b->block_count; ++i) {
+        Bulk_Block *block = &b->blocks[i];
+        bool held = block->primer && now < block->deadline;
+        if (held || !output_admits(&b->output, block->seq)) continue;
+
+        start_address(b, block);
+        if (!block->range.remaining) {
+            memmove(block, block + 1, (--b->block_count - i) * sizeof(Bulk_Block));
+        }
+        return true;
+    }
+
+    if (b->drained || b->block_count == BULK_BLOCK_LIMIT || !output_admits(&b->output, b->seq)) return false;
+    if (!b->range.remaining) {
+        String field = {0};
+        if (!next_field(b, &field)) {
+            b->drained = true;
+            return false;
+        }
+        if (!parse_range(field, &b->range)) {
+            start(b, b->seq++, NAME_ID_NONE, field, 0);
+            return true;
+        }
+    }
+
+    Bulk_Block *block = &b->blocks[b->block_count++];
+    split_block(b, block);
+    start_address(b, block);
+    if (!block->range.remaining) --b->block_count;
+    return true;
+}
+
+// NOTE(ariel) Wake up no later than the first primer that runs out of time.
+internal i64
+prime_timeout(Bulk *b, i64 wait)
+{
+    u64 now = stats_now();
+    for (u32 i = 0; i < b->block_count; ++i) {
+        Bulk_Block *block = &b->blocks[i];
+        if (!block->primer) continue;
+        i64 left = block->deadline > now ? (i64)(block->deadline - now) : 0;
+        wait = wait < 0 ? left : MIN(wait, left);
+    }
+    return wait;
+}
+
+// NOTE(ariel) Start to resolve the next name of the input, if any may start
+// now.
+internal bool
+admit(Bulk *b)
+{
+    if (b->config.reverse) return admit_address(b);
+    if (b->drained || !output_admits(&b->output, b->seq)) return false;
+
+    String name = {0};
+    if (!next_field(b, &name)) {
+        b->drained = true;
+        return false;
+    }
+    start(b, b->seq++, intern_text(&g_names, name), name, 0);
+    return true;
+}
+
+internal void
+begin_epoch(Bulk *b)
+{
+    intern_init(&g_names);
+    cache_init(&b->cache, BULK_CACHE_CAPACITY, BULK_CACHE_LIMIT);
+    t_cache = &b->cache;
+
+    // NOTE(ariel) The cache starts empty, so a block in the middle of its
+    // expansion needs a primer again.
+    for (u32 i = 0; i < b->block_count; ++i) {
+        b->blocks[i].prime = b->blocks[i].range.remaining > 1;
+    }
+}
+
+internal void
+end_epoch(Bulk *b)
+{
+    t_cache = 0;
+    cache_release(&b->cache);
+    intern_release(&g_names);
+}
+
+void
+bulk_run(Bulk_Config config)
+{
+    if (!config.concurrency) config.concurrency = BULK_CONCURRENCY;
+    config.concurrency = MIN(config.concurrency, DNS_ACTIVE_LIMIT);
+
+    arena_init(&g_arena);
+    stats_thread_init();
+
+    Bulk b = { .config = config };
+    open_input(&b.input, config.input);
+    output_init(&b.output, STDOUT_FILENO, config.format, config.window);
+    b.resolver = resolver_create();
+    b.requests = calloc(config.concurrency, sizeof(Bulk_Request));
+    if (!b.resolver || !b.requests) err_exit("failed to set up resolutions in bulk");
+    for (u32 i = 0; i < config.concurrency; ++i) {
+        b.requests[i].next = b.free;
+        b.free = &b.requests[i];
+    }
+    begin_epoch(&b);
+
+    u64 start = stats_now();
+    for (;;) {
+        Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+
+        // NOTE(ariel) Admit no more names in one turn than may be in flight,
+        // since answers from the cache or the overrides complete at once and
+        // their results take memory from the arena until the turn ends.
+        bool full = g_names.count >= BULK_NAME_LIMIT;
+        for (u32 i = 0; i < config.concurrency && !full; ++i) {
+            if (b.active == config.concurrency || !admit(&b)) break;
+            full = g_names.count >= BULK_NAME_LIMIT;
+        }
+
+        if (b.active) {
+            i64 wait = prime_timeout(&b, resolver_timeout(b.resolver));
+            int timeout = wait < 0 ? -1 : (wait + 999999) / 1000000;
+            struct pollfd pollfd = { .fd = resolver_fd(b.resolver), .events = POLLIN };
+            (void)poll(&pollfd, 1, timeout);
+            resolver_process(b.resolver);
+        } else if (full) {
+            end_epoch(&b);
+            begin_epoch(&b);
+        } else if (b.drained && !b.block_count) {
+            arena_checkpoint_restore(cp);
+            break;
+        }
+
+        arena_checkpoint_restore(cp);
+    }
+
+    end_epoch(&b);
+    resolver_destroy(b.resolver);
+    free(b.requests);
+    output_release(&b.output);
+
+    double seconds = (double)(stats_now() - start) / 1e9;
+    fprintf(stderr, "resolved %llu names in %.3f s (%.0f per second)\n",
+            (unsigned long long)b.seq, seconds, seconds > 0 ? b.seq / seconds : 0);
+    close_input(&b.input);
+    arena_release(&g_arena);
+}
@@ -0,0 +1,443 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "intern.h"
+#include "stats.h"
+
+enum { SHARED_CACHE_READ_ATTEMPTS = 4 };
+
+_Thread_local Cache *t_cache = 0;
+Shared_Cache *g_shared_cache = 0;
+
+void
+cache_init(Cache *c, u32 capacity, size_t limit)
+{
+    u32 slots = 1;
+    while (slots < 2 * capacity) slots <<= 1;
+
+    // NOTE(ariel) Leave at least three quarters of the ceiling to records.
+    while (slots > 2 && slots * sizeof(Cache_Entry) > limit / 4) slots >>= 1;
+    capacity = MIN(capacity, slots / 2);
+
+    *c = (Cache){0};
+    arena_init(&c->arena);
+    c->entries = arena_alloc(&c->arena, slots * sizeof(Cache_Entry));
+    c->mask = slots - 1;
+    c->capacity = capacity;
+    c->limit = limit;
+    c->committed = slots * sizeof(Cache_Entry);
+}
+
+void
+cache_release(Cache *c)
+{
+    arena_release(&c->arena);
+    *c = (Cache){0};
+}
+
+Cache_Usage
+cache_usage(Cache *c)
+{
+    return (Cache_Usage){
+        .entries = c->count,
+        .committed = c->committed,
+        .payload = c->payload,
+    };
+}
+
+
+/* ---
+ * Blocks of records.
+ * ---
+ */
+
+internal inline size_t
+class_size(u8 size_class)
+{
+    return (size_t)1 << (CACHE_BLOCK_MIN_SHIFT + size_class);
+}
+
+internal u8
+class_of(size_t size)
+{
+    u8 size_class = 0;
+    while (size_class < CACHE_SIZE_CLASS_COUNT && class_size(size_class) < size) ++size_class;
+    return size_class;
+}
+
+internal bool
+carve_slab(Cache *c, u8 size_class)
+{
+    if (c->committed + CACHE_SLAB_SIZE > c->limit) return false;
+
+    u8 *slab = arena_alloc(&c->arena, CACHE_SLAB_SIZE);
+    c->committed += CACHE_SLAB_SIZE;
+
+    size_t size = class_size(size_class);
+    for (size_t offset = 0; offset + size <= CACHE_SLAB_SIZE; offset += size) {
+        void **block = (void **)(slab + offset);
+        *block = c->free[size_class];
+        c->free[size_class] = block;
+    }
+
+    return true;
+}
+
+internal size_t
+records_size(Resource_Record *rrs, u32 count)
+{
+    size_t size = count * sizeof(Resource_Record);
+    for (u32 i = 0; i < count; ++i) {
+        if (rr_rdata_is_raw(rrs[i].type)) size += rrs[i].rdlength;
+    }
+    return size;
+}
+
+internal void
+release_block(Cache *c, Cache_Entry *e)
+{
+    // NOTE(ariel) Negative answers hold no records and so no block.
+    if (!e->rrs) return;
+
+    void **block = (void **)e->rrs;
+    *block = c->free[e->size_class];
+    c->free[e->size_class] = block;
+}
+
+
+/* ---
+ * Table of entries.
+ * ---
+ */
+
+internal inline u32
+slot_of(Cache *c, Name_ID name, u16 type)
+{
+    u64 h = ((u64)name << 16 | type) * 0x9e3779b97f4a7c15ull;
+    return (h >> 32) & c->mask;
+}
+
+internal u32
+find(Cache *c, Name_ID name, u16 type)
+{
+    u32 slot = slot_of(c, name, type);
+    for (;;) {
+        Cache_Entry *e = &c->entries[slot];
+        if (!e->name || (e->name == name && e->type == type)) return slot;
+        slot = (slot + 1) & c->mask;
+    }
+}
+
+internal void
+evict(Cache *c, u32 slot)
+{
+    Cache_Entry *e = &c->entries[slot];
+    c->payload -= records_size(e->rrs, e->count);
+    release_block(c, e);
+    --c->count;
+
+    // NOTE(ariel) Shift later entries of the same run of probes back into
+    // the hole, so lookups never need tombstones.
+    for (u32 next = slot;;) {
+        c->entries[slot] = (Cache_Entry){0};
+        for (;;) {
+            next = (next + 1) & c->mask;
+            Cache_Entry *candidate = &c->entries[next];
+            if (!candidate->name) return;
+
+            u32 home = slot_of(c, candidate->name, candidate->type);
+            if (((next - home) & c->mask) >= ((next - slot) & c->mask)) {
+                c->entries[slot] = *candidate;
+                slot = next;
+                break;
+            }
+        }
+    }
+}
+
+internal bool
+sweep(Cache *c, u64 now)
+{
+    // NOTE(ariel) Two revolutions of the hand suffice: the first clears every
+    // bit of reference, so the second must find a victim.
+    u64 grace = now + (u64)CACHE_GRACE_SECONDS * 1000000000;
+    for (u32 step = 0; c->count && step < 2 * (c->mask + 1); ++step) {
+        Cache_Entry *e = &c->entries[c->hand];
+        if (e->name && (e->expires <= grace || !e->referenced)) {
+            // NOTE(ariel) Eviction may shift another entry into the slot
+            // under the hand, so leave the hand where it is.
+            evict(c, c->hand);
+            stats_count(STAT_CACHE_EVICTIONS);
+            return true;
+        }
+
+        e->referenced = false;
+        c->hand = (c->hand + 1) & c->mask;
+    }
+
+    return false;
+}
+
+internal void *
+take_block(Cache *c, u8 size_class, u64 now)
+{
+    while (!c->free[size_class]) {
+        if (carve_slab(c, size_class)) break;
+        if (!sweep(c, now)) return 0;
+    }
+
+    void **block = c->free[size_class];
+    c->free[size_class] = *block;
+    return block;
+}
+
+internal Resource_Record *
+copy_records(Arena *arena, Resource_Record *rrs, u32 count)
+{
+    Resource_Record *copy = arena_alloc(arena, count * sizeof(Resource_Record));
+    memcpy(copy, rrs, count * sizeof(Resource_Record));
+
+    for (u32 i = 0; i < count; ++i) {
+        if (rr_rdata_is_raw(copy[i].type)) {
+            u8 *raw = arena_alloc(arena, copy[i].rdlength);
+            memcpy(raw, copy[i].rdata.raw, copy[i].rdlength);
+            copy[i].rdata.raw = raw;
+        }
+    }
+
+    return copy;
+}
+
+bool
+cache_lookup(Cache *c, Name_ID name, u16 type, u16 *rcode, Resource_Record_Array *rs)
+{
+    u32 slot = find(c, name, type);
+    Cache_Entry *e = &c->entries[slot];
+    if (!e->name) return false;
+
+    u64 now = stats_now();
+    if (e->expires <= now) {
+        evict(c, slot);
+        return false;
+    }
+    e->referenced = true;
+
+    // NOTE(ariel) Copy the records onto the arena of the caller, so they
+    // outlive any eviction, and count down their TTLs.
+    rs->rrs = copy_records(&g_arena, e->rrs, e->count);
+    rs->count = e->count;
+
+    i32 ttl = (e->expires - now) / 1000000000;
+    for (u32 i = 0; i < rs->count; ++i) rs->rrs[i].ttl = MIN(rs->rrs[i].ttl, ttl);
+
+    *rcode = e->rcode;
+    return true;
+}
+
+void
+cache_insert(Cache *c, Name_ID name, u16 type, u16 rcode, Resource_Record_Array rs, u32 ttl)
+{
+    if (!ttl) return;
+    u64 now = stats_now();
+
+
+    /* ---
+     * Measure the entry and drop any older entry for the same key.
+     * ---
+     */
+    size_t size = records_size(rs.rrs, rs.count);
+    u8 size_class = class_of(size);
+    if (size_class == CACHE_SIZE_CLASS_COUNT) return;
+
+    u32 slot = find(c, name, type);
+    if (c->entries[slot].name) evict(c, slot);
+
+
+    /* ---
+     * Make room for the entry and copy its records into a block.
+     * ---
+     */
+    if (c->count == c->capacity && !sweep(c, now)) return;
+
+    Resource_Record *copy = 0;
+    if (rs.count) {
+        u8 *block = take_block(c, size_class, now);
+        if (!block) return;
+
+        copy = (Resource_Record *)block;
+        u8 *raw = block + rs.count * sizeof(Resource_Record);
+        memcpy(copy, rs.rrs, rs.count * sizeof(Resource_Record));
+        for (u32 i = 0; i < rs.count; ++i) {
+            if (rr_rdata_is_raw(copy[i].type)) {
+                memcpy(raw, copy[i].rdata.raw, copy[i].rdlength);
+                copy[i].rdata.raw = raw;
+                raw += copy[i].rdlength;
+            }
+        }
+    }
+
+    // NOTE(ariel) Evictions above may have shifted entries, so probe again.
+    slot = find(c, name, type);
+    c->entries[slot] = (Cache_Entry){
+        .name = name,
+        .type = type,
+        .rcode = rcode,
+        .count = rs.count,
+        .size_class = size_class,
+        .expires = now + (u64)ttl * 1000000000,
+        .rrs = copy,
+    };
+    c->payload += size;
+    ++c->count;
+}
+
+void
+shared_cache_init(Shared_Cache *c, u32 capacity)
+{
+    u32 sets = 1;
+    while (sets * SHARED_CACHE_WAYS < capacity) sets <<= 1;
+
+    // NOTE(ariel) Align slots to lines of cache, so a writer to one slot never
+    // invalidates the line of a reader of its neighbor.
+    size_t size = (size_t)sets * SHARED_CACHE_WAYS * sizeof(Shared_Cache_Slot);
+    c->slots = aligned_alloc(64, size);
+    if (!c->slots) abort();
+    memset(c->slots, 0, size);
+    c->mask = sets - 1;
+}
+
+void
+shared_cache_release(Shared_Cache *c)
+{
+    free(c->slots);
+    *c = (Shared_Cache){0};
+}
+
+internal inline u64
+key_of(Name_ID name, u16 type)
+{
+    return intern_lookup_hash(&g_names, name) ^ (u64)type * 0x9e3779b97f4a7c15ull;
+}
+
+internal inline Shared_Cache_Slot *
+set_of(Shared_Cache *c, u64 key)
+{
+    return &c->slots[((key >> 32) & c->mask) * SHARED_CACHE_WAYS];
+}
+
+bool
+shared_cache_lookup(Shared_Cache *c, Name_ID name, u16 type, u16 *rcode, Resource_Record_Array *rs)
+{
+    String wire = intern_lookup_wire(&g_names, name);
+    u64 key = key_of(name, type);
+    Shared_Cache_Slot *set = set_of(c, key);
+    u64 now = stats_now();
+
+    Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+    u8 *data = arena_alloc(&g_arena, SHARED_CACHE_DATA_LIMIT);
+
+    for (u32 way = 0; way < SHARED_CACHE_WAYS; ++way) {
+        Shared_Cache_Slot *slot = &set[way];
+
+        for (u32 attempt = 0; attempt < SHARED_CACHE_READ_ATTEMPTS; ++attempt) {
+            u32 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+
+            // NOTE(ariel) Fields may tear while a writer holds the slot. A torn
+            // key at worst causes a miss; anything else is only trusted once
+            // the sequence proves the copy consistent.
+            Shared_Cache_Slot header = {0};
+            memcpy(&header, slot, offsetof(Shared_Cache_Slot, data));
+            if (header.hash != key || header.type != type) break;
+
+            u16 len = MIN(header.len, SHARED_CACHE_DATA_LIMIT);
+            memcpy(data, slot->data, len);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) continue;
+
+            if (header.expires <= now) break;
+            if (len < wire.len || memcmp(data, wire.str, wire.len)) break;
+
+            String records = { .str = data + wire.len, .len = len - wire.len };
+            if (!parse_records(rs, header.count, records)) break;
+
+            i32 ttl = (header.expires - now) / 1000000000;
+            for (u32 i = 0; i < rs->count; ++i) rs->rrs[i].ttl = MIN(rs->rrs[i].ttl, ttl);
+
+            *rcode = header.rcode;
+            return true;
+        }
+    }
+
+    arena_checkpoint_restore(cp);
+    return false;
+}
+
+void
+shared_cache_insert(Shared_Cache *c, Name_ID name, u16 type, u16 rcode, Resource_Record_Array rs, u32 ttl)
+{
+    if (!ttl) return;
+
+
+    /* ---
+     * Serialize the entry before claiming any slot.
+     * ---
+     */
+    u8 data[SHARED_CACHE_DATA_LIMIT];
+    String wire = intern_lookup_wire(&g_names, name);
+    if (wire.len > sizeof(data)) return;
+    memcpy(data, wire.str, wire.len);
+
+    // NOTE(ariel) Entries too large for a slot stay in the cache of the
+    // thread that resolved them.
+    size_t n = format_records(data + wire.len, sizeof(data) - wire.len, rs);
+    if (rs.count && !n) return;
+    u16 len = wire.len + n;
+
+
+    /* ---
+     * Replace the entry for the same key or else the one to expire first.
+     * ---
+     */
+    u64 key = key_of(name, type);
+    Shared_Cache_Slot *set = set_of(c, key);
+    Shared_Cache_Slot *victim = &set[0];
+    for (u32 way = 0; way < SHARED_CACHE_WAYS; ++way) {
+        Shared_Cache_Slot *slot = &set[way];
+        if (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) == key &&
+                __atomic_load_n(&slot->type, __ATOMIC_RELAXED) == type) {
+            victim = slot;
+            break;
+        }
+        if (__atomic_load_n(&slot->expires, __ATOMIC_RELAXED) <
+                __atomic_load_n(&victim->expires, __ATOMIC_RELAXED)) {
+            victim = slot;
+        }
+    }
+
+
+    /* ---
+     * Write the slot under its seqlock, unless another writer holds it.
+     * ---
+     */
+    u32 seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+    if (seq & 1) return;
+    if (!__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    victim->type = type;
+    victim->rcode = rcode;
+    victim->count = rs.count;
+    victim->len = len;
+    victim->hash = key;
+    victim->expires = stats_now() + (u64)ttl * 1000000000;
+    memcpy(victim->data, data, len);
+
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
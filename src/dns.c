@@ -1,17 +1,28 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <unistd.h>
 
 #include "arena.h"
+#include "cache.h"
 #include "common.h"
 #include "dns.h"
 #include "err_exit.h"
+#include "forward.h"
+#include "hosts.h"
+#include "intern.h"
+#include "root.h"
+#include "stats.h"
 #include "str.h"
+#include "timer.h"
+#include "trace.h"
 
 
 #define SERIALIZE_U8(i) \
@@ -24,10 +35,15 @@
         assert(sizeof(i) == sizeof(u16)); \
         *cur++ = i >> 8; *cur++ = i; \
     } while (0);
+#define SERIALIZE_U32(i) \
+    do { \
+        assert(sizeof(i) == sizeof(u32)); \
+        *cur++ = i >> 24; *cur++ = i >> 16; *cur++ = i >> 8; *cur++ = i; \
+    } while (0);
 #define SERIALIZE_STR(s) \
     do { \
         memcpy(cur, s.str, s.len); \
-        cur += label.len; \
+        cur += s.len; \
     } while (0);
 #define SERIALIZE_HEADER_FIELD(i) \
     do { \
@@ -47,6 +63,13 @@
         i = ntohs(i); \
         cur += sizeof(u16); \
     } while (0);
+#define DESERIALIZE_U32(i) \
+    do { \
+        assert(sizeof(i) == sizeof(u32)); \
+        memcpy(&i, cur, sizeof(i)); \
+        i = ntohl(i); \
+        cur += sizeof(u32); \
+    } while(0);
 #define DESERIALIZE_I32(i) \
     do { \
         assert(sizeof(i) == sizeof(i32)); \
@@ -54,9 +77,29 @@
         i = ntohl(i); \
         cur += sizeof(i32); \
     } while(0);
-#define DESERIALIZE_DOMAIN(s) \
+#define DESERIALIZE_DOMAIN(id) \
+    do { \
+        size_t n = parse_domain(&id, buf, cur); \
+        if (!n) return 0; \
+        cur += n; \
+    } while (0);
+#define DESERIALIZE_SECTION(rs, count) \
     do { \
-        cur += parse_domain(&s, buf, cur); \
+        if ((size_t)(count) * RR_SIZE_MIN > (size_t)(buf.str + buf.len - cur)) return 0; \
+        rs.rrs = arena_alloc(&g_arena, (count) * sizeof(Resource_Record)); \
+        for (size_t i = 0; i < (count); ++i) { \
+            size_t n = parse_resource_record(&rs, buf, cur); \
+            if (!n) return 0; \
+            cur += n; \
+        } \
+    } while (0);
+
+// NOTE(ariel) The parser treats every message as untrusted input. Each
+// function below reports a malformed message by returning zero rather than
+// reading beyond the bounds of the buffer.
+#define ENSURE_REMAINING(n) \
+    do { \
+        if ((size_t)(buf.str + buf.len - cur) < (size_t)(n)) return 0; \
     } while (0);
 
 
@@ -69,9 +112,29 @@ char *RR_TYPE_STRING[] = {
     [RR_TYPE_A]     = "A",
     [RR_TYPE_NS]    = "NS",
     [RR_TYPE_CNAME] = "CNAME",
+    [RR_TYPE_SOA]   = "SOA",
+    [RR_TYPE_PTR]   = "PTR",
+    [RR_TYPE_MX]    = "MX",
+    [RR_TYPE_TXT]   = "TXT",
     [RR_TYPE_AAAA]  = "AAAA",
+    [RR_TYPE_SRV]   = "SRV",
+};
+
+char *DNS_STATUS_STRING[] = {
+    [DNS_OK]                = "success",
+    [DNS_ERR_INVALID_NAME]  = "invalid domain name",
+    [DNS_ERR_NETWORK]       = "failed to exchange messages with nameserver",
+    [DNS_ERR_TIMEOUT]       = "nameserver did not reply in time",
+    [DNS_ERR_MALFORMED]     = "received malformed DNS reply",
+    [DNS_ERR_NO_NAMESERVER] = "DNS reply does not lead to any nameserver",
+    [DNS_ERR_HOP_LIMIT]     = "exceeded limit of referrals to follow",
+    [DNS_ERR_BUSY]          = "too many resolutions in flight",
 };
 
+// NOTE(ariel) A resource record occupies at least a single octet for the
+// root as its owner followed by its type, class, TTL and length of rdata.
+enum { RR_SIZE_MIN = 11 };
+
 
 internal inline void
 check_addr_valid(int res)
@@ -118,18 +181,53 @@ encode_ip(char *ip, sockaddr_storage *addr)
     }
 }
 
+Name_ID
+reverse_name(int family, u8 *addr)
+{
+    // NOTE(ariel) Write the labels straight into wire form, least significant
+    // part of the address first: one decimal label per octet of an IPv4
+    // address, one hexadecimal label per nibble of an IPv6 address.
+    char suffix_ipv4[] = "\x07" "in-addr" "\x04" "arpa";
+    char suffix_ipv6[] = "\x03" "ip6" "\x04" "arpa";
+    char *hex = "0123456789abcdef";
+
+    u8 wire[DNS_DOMAIN_LIMIT] = {0};
+    u8 *p = wire;
+    if (family == AF_INET) {
+        for (i32 i = 3; i >= 0; --i) {
+            u8 *len = p++;
+            if (addr[i] >= 100) *p++ = '0' + addr[i] / 100;
+            if (addr[i] >= 10) *p++ = '0' + addr[i] / 10 % 10;
+            *p++ = '0' + addr[i] % 10;
+            *len = p - len - 1;
+        }
+        memcpy(p, suffix_ipv4, sizeof(suffix_ipv4));
+        p += sizeof(suffix_ipv4);
+    } else {
+        for (i32 i = 15; i >= 0; --i) {
+            *p++ = 1;
+            *p++ = hex[addr[i] & 0xf];
+            *p++ = 1;
+            *p++ = hex[addr[i] >> 4];
+        }
+        memcpy(p, suffix_ipv6, sizeof(suffix_ipv6));
+        p += sizeof(suffix_ipv6);
+    }
+
+    return intern_wire(&g_names, (String){ .str = wire, .len = p - wire });
+}
+
 internal DNS_Query
-init_query(String hostname, int socktype)
+init_query(Name_ID name, u16 qtype)
 {
-    assert(socktype == AF_INET || socktype == AF_INET6);
     return (DNS_Query){
         .header = {
-            .id = rand(),
             .qdcount = 1,
         },
         .question = {
-            .domain = hostname,
-            .qtype = socktype == AF_INET ? RR_TYPE_A : RR_TYPE_AAAA,
+            .domain = intern_lookup_text(&g_names, name),
+            .name = name,
+            .qtype = qtype,
             .qclass = RR_CLASS_IN,
         },
     };
@@ -165,124 +263,155 @@ format_query(DNS_Query query, u8 *buf)
      * ---
      */
     {
-        Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
-
-        String_List ls = string_split(query.question.domain, '.');
-        String_Node *n = ls.head;
-
-        while (n) {
-            String label = n->string;
-            if (label.len) {
-                SERIALIZE_U8((u8)label.len);
-                SERIALIZE_STR(label);
-            }
-            n = n->next;
-        }
-
-        // NOTE(ariel) Terminate QNAME with the zero length octet (byte) for
-        // the null label of the root.
-        SERIALIZE_U8((u8)0);
+        // NOTE(ariel) The interned name is already in wire form, terminated
+        // by the null label of the root.
+        String qname = intern_lookup_wire(&g_names, query.question.name);
+        SERIALIZE_STR(qname);
 
         SERIALIZE_U16(query.question.qtype);
         SERIALIZE_U16(query.question.qclass);
-
-        arena_checkpoint_restore(cp);
     }
 
 
     return cur - buf;
 }
 
-internal void
-send_query(DNS_Query query, int sockfd, sockaddr_storage addr)
-{
-    u8 buf[UDP_MSG_LIMIT] = {0};
-    size_t len = format_query(query, (u8 *)buf);
-    if (sendto(sockfd, buf, len, 0, (sockaddr *)&addr, sizeof(addr)) == -1)
-        err_exit("failed to send DNS query");
-}
-
-internal String
-parse_ipv4_addr(u8 *cur)
+internal Query_Template
+compile_query(Name_ID name, u16 qtype, u16 flags)
 {
-    String addr = { .len = INET_ADDRSTRLEN };
-    addr.str = arena_alloc(&g_arena, addr.len);
-
-    i32 len = snprintf((char *)addr.str, addr.len, "%d.%d.%d.%d", cur[0], cur[1], cur[2], cur[3]);
-    if (len == -1) err_exit("failed to parse IPv4 address");
-    assert((u32)len <= addr.len);
-    addr.str = arena_realloc(&g_arena, len);
-    addr.len = len;
-
-    return addr;
-}
-
-internal String
-parse_ipv6_addr(u8 *cur)
-{
-    String addr = { .len = INET6_ADDRSTRLEN };
-    addr.str = arena_alloc(&g_arena, addr.len);
-
-    i32 len = snprintf((char *)addr.str, addr.len,
-            "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x",
-            cur[0], cur[1], cur[2], cur[3], cur[4], cur[5], cur[6], cur[7],
-            cur[8], cur[9], cur[10], cur[11], cur[12], cur[13], cur[14], cur[15]);
-    if (len == -1) err_exit("failed to parse IPv6 address");
-    assert((u32)len <= addr.len);
-    addr.str = arena_realloc(&g_arena, len);
-    addr.len = len;
-
-    return addr;
+    DNS_Query query = init_query(name, qtype);
+    Query_Template template = {
+        .flags = flags,
+        .qtype = qtype,
+        .name = query.question.name,
+    };
+    template.len = format_query(query, template.buf);
+    return template;
 }
 
 internal size_t
-parse_domain(String *domain, String buf, u8 *cur)
+parse_domain(Name_ID *name, String buf, u8 *cur)
 {
     u8 *checkpoint = cur;
+    u8 *end = buf.str + buf.len;
 
     u8 pointer_mask = 0xc0;
-    String_List labels = {0};
+    size_t consumed = 0;
+
+    // NOTE(ariel) Every compression pointer must jump strictly backward from
+    // the start of the segment of labels it terminates. The sequence of
+    // segments then visits strictly decreasing offsets, so the loop below
+    // terminates on any input, including pointers that form cycles.
+    u8 *segment = cur;
+
+    // NOTE(ariel) Decompress the name into wire form to intern it.
+    u8 wire[DNS_DOMAIN_LIMIT] = {0};
+    size_t wire_len = 0;
 
     for (;;) {
+        if (cur >= end) return 0;
+
         u8 len = 0;
         DESERIALIZE_U8(len);
         if (!len) {
             break;
         } else if ((pointer_mask & len) == pointer_mask) {
-            --cur;
-
-            u16 offset = 0;
-            DESERIALIZE_U16(offset);
-            offset &= ~(pointer_mask << 8);
+            if (cur >= end) return 0;
 
-            // NOTE(ariel) Ensure cursor remains within bounds.
-            if (cur < buf.str || cur > buf.str + buf.len)
-                err_exit("DNS label contains pointer to outside the bounds of the message");
+            u16 offset = (len & ~pointer_mask) << 8 | *cur++;
+            if (!consumed) consumed = cur - checkpoint;
 
-            (void)parse_domain(domain, buf, buf.str + offset);
-            push_string(&labels, *domain);
+            // NOTE(ariel) Ensure cursor remains within bounds and moves
+            // backward.
+            u8 *target = buf.str + offset;
+            if (target >= segment) return 0;
 
-            break;
+            segment = cur = target;
+        } else if (pointer_mask & len) {
+            // NOTE(ariel) Reject the extended and reserved label types.
+            return 0;
         } else {
-            String_Node *label = arena_alloc(&g_arena, sizeof(String_Node));
-            label->string.str = cur;
-            label->string.len = len;
-            push_string_node(&labels, label);
+            if (cur + len > end) return 0;
+            if (wire_len + 1 + len >= DNS_DOMAIN_LIMIT - 1) return 0;
+
+            wire[wire_len++] = len;
+            memcpy(wire + wire_len, cur, len);
+            wire_len += len;
             cur += len;
         }
     }
+    wire[wire_len++] = 0;
 
-    *domain = string_list_join(labels, '.');
-    return cur - checkpoint;
+    if (!consumed) consumed = cur - checkpoint;
+
+    *name = intern_wire(&g_names, (String){ .str = wire, .len = wire_len });
+    if (!*name) return 0;
+
+    return consumed;
+}
+
+internal bool
+parse_rdata(Resource_Record *rr, String buf, u8 *cur)
+{
+    // NOTE(ariel) The buffer ends with the rdata of this record, so every
+    // check against its bounds below also enforces `rdlength`. It still
+    // begins at the start of the message for compression pointers.
+    switch (rr->type) {
+        case RR_TYPE_A: {
+            if (rr->rdlength != sizeof(rr->rdata.a)) return false;
+            memcpy(rr->rdata.a, cur, sizeof(rr->rdata.a));
+            break;
+        }
+        case RR_TYPE_AAAA: {
+            if (rr->rdlength != sizeof(rr->rdata.aaaa)) return false;
+            memcpy(rr->rdata.aaaa, cur, sizeof(rr->rdata.aaaa));
+            break;
+        }
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR: {
+            DESERIALIZE_DOMAIN(rr->rdata.name);
+            break;
+        }
+        case RR_TYPE_MX: {
+            ENSURE_REMAINING(2);
+            DESERIALIZE_U16(rr->rdata.mx.preference);
+            DESERIALIZE_DOMAIN(rr->rdata.mx.exchange);
+            break;
+        }
+        case RR_TYPE_SRV: {
+            ENSURE_REMAINING(6);
+            DESERIALIZE_U16(rr->rdata.srv.priority);
+            DESERIALIZE_U16(rr->rdata.srv.weight);
+            DESERIALIZE_U16(rr->rdata.srv.port);
+            DESERIALIZE_DOMAIN(rr->rdata.srv.target);
+            break;
+        }
+        case RR_TYPE_SOA: {
+            DESERIALIZE_DOMAIN(rr->rdata.soa.mname);
+            DESERIALIZE_DOMAIN(rr->rdata.soa.rname);
+            ENSURE_REMAINING(20);
+            DESERIALIZE_U32(rr->rdata.soa.serial);
+            DESERIALIZE_U32(rr->rdata.soa.refresh);
+            DESERIALIZE_U32(rr->rdata.soa.retry);
+            DESERIALIZE_U32(rr->rdata.soa.expire);
+            DESERIALIZE_U32(rr->rdata.soa.minimum);
+            break;
+        }
+        default: {
+            rr->rdata.raw = cur;
+            break;
+        }
+    }
+
+    return true;
 }
 
 internal size_t
-parse_resource_record(Resource_Record_List *rs, String buf, u8 *cur)
+parse_resource_record(Resource_Record_Array *rs, String buf, u8 *cur)
 {
     u8 *checkpoint = cur;
-
-    Resource_Record_Link *link = arena_alloc(&g_arena, sizeof(Resource_Record_Link));
-    Resource_Record *rr = &link->rr;
+    Resource_Record *rr = &rs->rrs[rs->count];
 
 
     /* ---
@@ -290,11 +419,13 @@ parse_resource_record(Resource_Record_List *rs, String buf, u8 *cur)
      * ---
      */
     {
-        DESERIALIZE_DOMAIN(rr->name);
+        DESERIALIZE_DOMAIN(rr->owner);
+        ENSURE_REMAINING(10);
         DESERIALIZE_U16(rr->type);
-        DESERIALIZE_U16(rr->class); assert(rr->class == RR_CLASS_IN);
+        DESERIALIZE_U16(rr->class);
         DESERIALIZE_I32(rr->ttl);
         DESERIALIZE_U16(rr->rdlength);
+        ENSURE_REMAINING(rr->rdlength);
     }
 
 
@@ -302,65 +433,32 @@ parse_resource_record(Resource_Record_List *rs, String buf, u8 *cur)
      * Parse rdata field.
      * ---
      */
-    switch (rr->type) {
-        case RR_TYPE_A: {
-            assert(rr->rdlength == 4);
-            String addr = parse_ipv4_addr(cur);
-            rr->rdlength = addr.len;
-            rr->rdata = addr.str;
-            cur += 4;
-
-            link->next = rs->A;
-            rs->A = link;
-            break;
-        }
-        case RR_TYPE_NS: {
-            String name = {0};
-            cur += parse_domain(&name, buf, cur);
-            rr->rdlength = name.len;
-            rr->rdata = name.str;
-
-            link->next = rs->NS;
-            rs->NS = link;
-            break;
-        }
-        case RR_TYPE_CNAME: {
-            String canon = {0};
-            cur += parse_domain(&canon, buf, cur);
-            rr->rdlength = canon.len;
-            rr->rdata = canon.str;
-
-            link->next = rs->CNAME;
-            rs->CNAME = link;
-            break;
+    {
+        String rdata = {
+            .str = buf.str,
+            .len = cur + rr->rdlength - buf.str,
+        };
+
+        // NOTE(ariel) Skip records outside the Internet class, e.g. the OPT
+        // pseudo-record, which reuses the field for the size of its UDP
+        // payload.
+        if (rr->class == RR_CLASS_IN) {
+            if (!parse_rdata(rr, rdata, cur)) return 0;
+            ++rs->count;
         }
-        case RR_TYPE_AAAA: {
-            assert(rr->rdlength == 16);
 
-            String addr = parse_ipv6_addr(cur);
-            rr->rdlength = addr.len;
-            rr->rdata = addr.str;
-            cur += 16;
-
-            link->next = rs->AAAA;
-            rs->AAAA = link;
-            break;
-        }
-        default: {
-            cur += rr->rdlength;
-            break;
-        }
+        cur += rr->rdlength;
     }
 
 
     return cur - checkpoint;
 }
 
-internal DNS_Reply
-parse_reply(String buf)
+bool
+parse_reply(DNS_Reply *reply, String buf)
 {
     u8 *cur = buf.str;
-    DNS_Reply reply = {0};
+    *reply = (DNS_Reply){0};
 
 
     /* ---
@@ -370,12 +468,13 @@ parse_reply(String buf)
     {
         u8 *header = cur;
 
-        DESERIALIZE_U16(reply.header.id);
-        DESERIALIZE_U16(reply.header.flags);
-        DESERIALIZE_U16(reply.header.qdcount);
-        DESERIALIZE_U16(reply.header.ancount);
-        DESERIALIZE_U16(reply.header.nscount);
-        DESERIALIZE_U16(reply.header.arcount);
+        ENSURE_REMAINING(DNS_HEADER_LIMIT);
+        DESERIALIZE_U16(reply->header.id);
+        DESERIALIZE_U16(reply->header.flags);
+        DESERIALIZE_U16(reply->header.qdcount);
+        DESERIALIZE_U16(reply->header.ancount);
+        DESERIALIZE_U16(reply->header.nscount);
+        DESERIALIZE_U16(reply->header.arcount);
 
         // NOTE(ariel) Confirm the entire header has been read.
         assert(cur == header + DNS_HEADER_LIMIT);
@@ -387,11 +486,15 @@ parse_reply(String buf)
      * ---
      */
     {
-        assert(reply.header.qdcount == 1);
-
-        cur += parse_domain(&reply.question.domain, buf, cur);
-        DESERIALIZE_U16(reply.question.qtype);
-        DESERIALIZE_U16(reply.question.qclass);
+        if (reply->header.qdcount != 1) return false;
+
+        u8 *qname = cur;
+        DESERIALIZE_DOMAIN(reply->question.name);
+        reply->question.domain = intern_lookup_text(&g_names, reply->question.name);
+        reply->question.wire = (String){ .str = qname, .len = cur - qname };
+        ENSURE_REMAINING(4);
+        DESERIALIZE_U16(reply->question.qtype);
+        DESERIALIZE_U16(reply->question.qclass);
     }
 
 
@@ -399,164 +502,1431 @@ parse_reply(String buf)
      * Parse answer section of DNS reply.
      * ---
      */
-    for (size_t i = 0; i < reply.header.ancount; ++i)
-        cur += parse_resource_record(&reply.answer, buf, cur);
+    DESERIALIZE_SECTION(reply->answer, reply->header.ancount);
 
 
     /* ---
      * Parse authority section of DNS reply.
      * ---
      */
-    for (size_t i = 0; i < reply.header.nscount; ++i)
-        cur += parse_resource_record(&reply.authority, buf, cur);
+    DESERIALIZE_SECTION(reply->authority, reply->header.nscount);
 
 
     /* ---
      * Parse additional records included in DNS reply.
      * ---
      */
-    for (size_t i = 0; i < reply.header.arcount; ++i)
-        cur += parse_resource_record(&reply.additional, buf, cur);
+    DESERIALIZE_SECTION(reply->additional, reply->header.arcount);
 
 
-    return reply;
+    TRACE(TRACE_REPLY_PARSED, TRACE_REASON_NONE, 0, reply->question.domain, 0,
+            reply->answer.count, reply->authority.count, reply->additional.count, reply->header.flags);
+    return true;
 }
 
-internal DNS_Reply
-recv_reply(int sockfd, sockaddr_storage addr)
+internal size_t
+format_resource_record(Resource_Record *rr, u8 *buf, u8 *end)
 {
-    socklen_t socklen = sizeof(addr);
-    ssize_t len = recvfrom(sockfd, 0, 0, MSG_TRUNC | MSG_PEEK, (sockaddr *)&addr, &socklen);
-    if (len == -1) err_exit("failed to read length of received message");
+    u8 *cur = buf;
+    Resource_Record_Data *d = &rr->rdata;
+    String owner = intern_lookup_wire(&g_names, rr->owner);
+
+
+    /* ---
+     * Measure the record to ensure it fits.
+     * ---
+     */
+    size_t rdlength = 0;
+    switch (rr->type) {
+        case RR_TYPE_A: rdlength = sizeof(d->a); break;
+        case RR_TYPE_AAAA: rdlength = sizeof(d->aaaa); break;
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR: rdlength = intern_lookup_wire(&g_names, d->name).len; break;
+        case RR_TYPE_MX: rdlength = 2 + intern_lookup_wire(&g_names, d->mx.exchange).len; break;
+        case RR_TYPE_SRV: rdlength = 6 + intern_lookup_wire(&g_names, d->srv.target).len; break;
+        case RR_TYPE_SOA: {
+            rdlength = intern_lookup_wire(&g_names, d->soa.mname).len;
+            rdlength += intern_lookup_wire(&g_names, d->soa.rname).len + 20;
+            break;
+        }
+        default: rdlength = rr->rdlength; break;
+    }
+    if (owner.len + 10 + rdlength > (size_t)(end - cur)) return 0;
+
+
+    /* ---
+     * Serialize the record without compression.
+     * ---
+     */
+    SERIALIZE_STR(owner);
+    SERIALIZE_U16(rr->type);
+    SERIALIZE_U16(rr->class);
+    SERIALIZE_U32((u32)rr->ttl);
+    SERIALIZE_U16((u16)rdlength);
 
-    String buf = {
+    switch (rr->type) {
+        case RR_TYPE_A: memcpy(cur, d->a, sizeof(d->a)); cur += sizeof(d->a); break;
+        case RR_TYPE_AAAA: memcpy(cur, d->aaaa, sizeof(d->aaaa)); cur += sizeof(d->aaaa); break;
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR: {
+            String name = intern_lookup_wire(&g_names, d->name);
+            SERIALIZE_STR(name);
+            break;
+        }
+        case RR_TYPE_MX: {
+            String name = intern_lookup_wire(&g_names, d->mx.exchange);
+            SERIALIZE_U16(d->mx.preference);
+            SERIALIZE_STR(name);
+            break;
+        }
+        case RR_TYPE_SRV: {
+            String name = intern_lookup_wire(&g_names, d->srv.target);
+            SERIALIZE_U16(d->srv.priority);
+            SERIALIZE_U16(d->srv.weight);
+            SERIALIZE_U16(d->srv.port);
+            SERIALIZE_STR(name);
+            break;
+        }
+        case RR_TYPE_SOA: {
+            String mname = intern_lookup_wire(&g_names, d->soa.mname);
+            String rname = intern_lookup_wire(&g_names, d->soa.rname);
+            SERIALIZE_STR(mname);
+            SERIALIZE_STR(rname);
+            SERIALIZE_U32(d->soa.serial);
+            SERIALIZE_U32(d->soa.refresh);
+            SERIALIZE_U32(d->soa.retry);
+            SERIALIZE_U32(d->soa.expire);
+            SERIALIZE_U32(d->soa.minimum);
+            break;
+        }
+        default: memcpy(cur, d->raw, rdlength); cur += rdlength; break;
+    }
+
+    return cur - buf;
+}
+
+size_t
+format_response(u8 *buf, size_t cap, DNS_Query *query, Resolution *resolution)
+{
+    u8 *cur = buf;
+    u8 *end = buf + cap;
+    assert(cap >= DNS_HEADER_LIMIT);
+
+    u16 rcode = resolution->status ? DNS_RCODE_SERVFAIL : resolution->rcode;
+    u16 flags = DNS_HEADER_FLAG_QR | (query->header.flags & DNS_HEADER_FLAG_RD) | DNS_HEADER_FLAG_RA | rcode;
+    u16 ancount = 0;
+
+
+    /* ---
+     * Serialize the question and as many answers as fit behind the header.
+     * ---
+     */
+    u8 *header = cur;
+    cur += DNS_HEADER_LIMIT;
+
+    // NOTE(ariel) Echo the name exactly as the client spelled it, since a
+    // client may randomize its case as a check on the response, unless it
+    // arrived compressed.
+    String qname = intern_lookup_wire(&g_names, query->question.name);
+    if (query->question.wire.len == qname.len) qname = query->question.wire;
+    if (qname.len + 4 > (size_t)(end - cur)) return 0;
+    SERIALIZE_STR(qname);
+    SERIALIZE_U16(query->question.qtype);
+    SERIALIZE_U16(query->question.qclass);
+
+    if (!resolution->status) {
+        for (u32 i = 0; i < resolution->answer.count; ++i) {
+            size_t n = format_resource_record(&resolution->answer.rrs[i], cur, end);
+            if (!n) {
+                flags |= DNS_HEADER_FLAG_TC;
+                break;
+            }
+            cur += n;
+            ++ancount;
+        }
+    }
+
+
+    /* ---
+     * Serialize the header of the response.
+     * ---
+     */
+    {
+        u8 *answers = cur;
+        cur = header;
+
+        u16 qdcount = 1;
+        u16 nscount = 0;
+        u16 arcount = 0;
+        SERIALIZE_HEADER_FIELD(query->header.id);
+        SERIALIZE_HEADER_FIELD(flags);
+        SERIALIZE_HEADER_FIELD(qdcount);
+        SERIALIZE_HEADER_FIELD(ancount);
+        SERIALIZE_HEADER_FIELD(nscount);
+        SERIALIZE_HEADER_FIELD(arcount);
+
+        cur = answers;
+    }
+
+
+    return cur - buf;
+}
+
+size_t
+format_records(u8 *buf, size_t cap, Resource_Record_Array rs)
+{
+    u8 *cur = buf;
+    u8 *end = buf + cap;
+
+    for (u32 i = 0; i < rs.count; ++i) {
+        size_t n = format_resource_record(&rs.rrs[i], cur, end);
+        if (!n) return 0;
+        cur += n;
+    }
+
+    return cur - buf;
+}
+
+bool
+parse_records(Resource_Record_Array *rs, u32 count, String buf)
+{
+    u8 *cur = buf.str;
+    *rs = (Resource_Record_Array){0};
+
+    DESERIALIZE_SECTION((*rs), count);
+    return cur == buf.str + buf.len;
+}
+
+internal Resource_Record *
+find_resource_record(Resource_Record_Array rs, Name_ID name)
+{
+    for (u32 i = 0; i < rs.count; ++i) {
+        Resource_Record *rr = &rs.rrs[i];
+        if (rr->owner == name && (rr->type == RR_TYPE_A || rr->type == RR_TYPE_AAAA)) return rr;
+    }
+    return 0;
+}
+
+internal void
+decode_ip(Resource_Record *rr, sockaddr_storage *addr)
+{
+    *addr = (sockaddr_storage){0};
+    if (rr->type == RR_TYPE_A) {
+        sockaddr_in *sa = (sockaddr_in *)addr;
+        sa->sin_family = AF_INET;
+        sa->sin_port = DNS_PORT;
+        memcpy(&sa->sin_addr, rr->rdata.a, sizeof(rr->rdata.a));
+    } else {
+        assert(rr->type == RR_TYPE_AAAA);
+        sockaddr_in6 *sa = (sockaddr_in6 *)addr;
+        sa->sin6_family = AF_INET6;
+        sa->sin6_port = DNS_PORT;
+        memcpy(&sa->sin6_addr, rr->rdata.aaaa, sizeof(rr->rdata.aaaa));
+    }
+}
+
+internal u32
+answer_ttl(DNS_Reply *reply)
+{
+    // NOTE(ariel) Keep a positive answer as long as its shortest-lived record
+    // and a negative answer as long as RFC 2308 allows, i.e. the smaller of
+    // the TTL of the SOA record in the authority section and its minimum.
+    i64 ttl = -1;
+    if (reply->answer.count) {
+        for (u32 i = 0; i < reply->answer.count; ++i) {
+            i32 rr_ttl = MAX(reply->answer.rrs[i].ttl, 0);
+            ttl = ttl == -1 ? rr_ttl : MIN(ttl, rr_ttl);
+        }
+    } else {
+        for (u32 i = 0; i < reply->authority.count; ++i) {
+            Resource_Record *rr = &reply->authority.rrs[i];
+            if (rr->type == RR_TYPE_SOA) ttl = MIN((u32)MAX(rr->ttl, 0), rr->rdata.soa.minimum);
+        }
+    }
+    return ttl == -1 ? 0 : ttl;
+}
+
+internal bool
+cache_find(Name_ID name, u16 type, u16 *rcode, Resource_Record_Array *rs)
+{
+    if (t_cache && cache_lookup(t_cache, name, type, rcode, rs)) return true;
+    if (g_shared_cache && shared_cache_lookup(g_shared_cache, name, type, rcode, rs)) return true;
+    return false;
+}
+
+internal void
+cache_remember(Name_ID name, u16 type, u16 rcode, Resource_Record_Array rs, u32 ttl)
+{
+    if (t_cache) cache_insert(t_cache, name, type, rcode, rs, ttl);
+    if (g_shared_cache) shared_cache_insert(g_shared_cache, name, type, rcode, rs, ttl);
+}
+
+// NOTE(ariel) Return the zone of the closest delegation, or `NAME_ID_NONE`.
+internal Name_ID
+find_delegation(Name_ID name, sockaddr_storage *addr)
+{
+    if (!t_cache && !g_shared_cache) return NAME_ID_NONE;
+
+    // NOTE(ariel) Walk up the labels of the name to the closest zone cut with
+    // a known nameserver. Stop short of the root, where resolution starts
+    // anyway. A zone this thread never interned may still have an entry in
+    // the shared cache, so intern every suffix when one exists.
+    String wire = intern_lookup_wire(&g_names, name);
+    for (size_t i = 0; wire.str[i]; i += 1 + wire.str[i]) {
+        String suffix = { .str = wire.str + i, .len = wire.len - i };
+        Name_ID zone = g_shared_cache ? intern_wire(&g_names, suffix) : intern_find_wire(&g_names, suffix);
+        if (!zone) continue;
+
+        u16 rcode = 0;
+        Resource_Record_Array rs = {0};
+        if (cache_find(zone, CACHE_TYPE_DELEGATION, &rcode, &rs) && rs.count) {
+            decode_ip(&rs.rrs[0], addr);
+            return zone;
+        }
+    }
+
+    return NAME_ID_NONE;
+}
+
+// NOTE(ariel) Whether `name` is `zone` or lies below it. `NAME_ID_NONE`
+// stands for the root, above every name.
+internal bool
+in_bailiwick(Name_ID name, Name_ID zone)
+{
+    if (zone == NAME_ID_NONE || name == zone) return true;
+
+    String wire = intern_lookup_wire(&g_names, name);
+    String cut = intern_lookup_wire(&g_names, zone);
+    for (size_t i = 0; wire.str[i]; i += 1 + wire.str[i]) {
+        if (wire.len - i == cut.len) return !memcmp(wire.str + i, cut.str, cut.len);
+    }
+    return false;
+}
+
+internal void
+remember_delegation(Name_ID zone, i32 ns_ttl, Resource_Record *address)
+{
+    Resource_Record_Array rs = {
+        .rrs = address,
+        .count = 1,
+    };
+    u32 ttl = MIN(MAX(ns_ttl, 0), MAX(address->ttl, 0));
+    cache_remember(zone, CACHE_TYPE_DELEGATION, DNS_RCODE_NOERROR, rs, ttl);
+}
+
+
+/* ---
+ * Engine of resolutions.
+ * ---
+ */
+
+// NOTE(ariel) A frame iterates toward the answer for one name. A referral
+// without glue pushes a frame above it to resolve the address of the
+// nameserver, and the frame below resumes once that one completes.
+typedef struct {
+    Name_ID name;
+    u16 qtype;
+    u32 hops;
+    sockaddr_storage addr;
+    Name_ID cut;   // NOTE(ariel) The zone of `addr`, or `NAME_ID_NONE` for the root.
+
+    // NOTE(ariel) Nameserver of the referral that awaits the frame above.
+    Name_ID ns;
+    Name_ID zone;
+    i32 ns_ttl;
+
+    u64 start;
+    Trace_Span previous;
+} Frame;
+
+typedef struct Lookup Lookup;
+struct Lookup {
+    Resolver *resolver;
+    Lookup *next;
+    Lookup *all;
+
+    Frame frames[DNS_DEPTH_LIMIT];
+    u32 depth;
+
+    // NOTE(ariel) Transmissions of the query of the top frame to its current
+    // nameserver. A reply to any of them answers the query, as long as its
+    // bit in `pending` says it still awaits one. Once they run out, the frame
+    // ends with `failure`.
+    Query_Template template;
+    u16 ids[DNS_TRANSMIT_LIMIT];
+    u32 transmissions;
+    u32 pending;
+    u64 sent;
+    Resolution failure;
+
+    // NOTE(ariel) In forwarding mode, every transmission may go to another
+    // upstream, so keep which one and when.
+    bool forward;
+    u32 tried;
+    i32 upstreams[DNS_TRANSMIT_LIMIT];
+    u64 times[DNS_TRANSMIT_LIMIT];
+
+    Timer retransmit;
+    Timer deadline;
+    Trace_Span span;
+
+    Resolve_Callback callback;
+    void *user;
+};
+
+// NOTE(ariel) An off-path attacker who wants to forge a reply has to guess
+// both the ID of a query and the port it left from. So the IDs come from the
+// CSPRNG of the kernel, and queries leave from a pool of sockets bound to
+// random ports. Each socket of the pool gives way to a fresh one on another
+// port once it has served for the length of a resolution, and it keeps
+// receiving until the next rotation of its slot, by which time every query
+// it sent has timed out anyway. A reply only counts on the socket its query
+// left from.
+enum {
+    UDP_SOCKET_COUNT    = 8,
+    UDP_ROTATE_MS       = DNS_RESOLUTION_MS,
+    UDP_BIND_ATTEMPTS   = 8,
+};
+
+// NOTE(ariel) Bytes from the CSPRNG of the kernel, drawn in batches so that
+// a query costs no system call of its own.
+typedef struct {
+    u8 bytes[256];
+    u32 used;
+} Random_Pool;
+
+typedef struct {
+    int current;
+    int previous;
+    u64 opened;
+} Udp_Socket;
+
+typedef struct {
+    Transport transport;
+    int family;
+
+    Udp_Socket sockets[UDP_SOCKET_COUNT];
+    u8 slots[1 << 16];   // NOTE(ariel) The slot each ID left from.
+
+    // NOTE(ariel) Sockets with datagrams waiting, as epoll last reported.
+    int ready[2 * UDP_SOCKET_COUNT];
+    u32 ready_count;
+
+    Random_Pool random;
+} Udp_Transport;
+
+struct Resolver {
+    Transport *transport;
+    Udp_Transport *udp;
+    u32 active;
+    u64 retransmit;
+    Timer_Wheel timers;
+
+    // NOTE(ariel) Replies arrive through the one transport of the resolver,
+    // so the ID of a reply is what leads back to its lookup.
+    Lookup **ids;
+    Lookup *free;
+    Lookup *all;
+
+    u8 buf[UINT16_MAX];
+};
+
+global _Thread_local Resolver *t_resolver;
+
+internal void begin_frame(Lookup *lookup, Name_ID name, u16 qtype);
+internal void end_frame(Lookup *lookup, Resolution resolution);
+
+
+/* ---
+ * Exchange datagrams over a pool of sockets.
+ * ---
+ */
+
+internal bool
+random_draw(Random_Pool *pool, void *out, size_t len)
+{
+    if (!pool->used || pool->used + len > sizeof(pool->bytes)) {
+        // NOTE(ariel) Requests of up to 256 bytes never return short.
+        ssize_t n = 0;
+        do n = getrandom(pool->bytes, sizeof(pool->bytes), 0); while (n == -1 && errno == EINTR);
+        if (n != sizeof(pool->bytes)) return false;
+        pool->used = 0;
+    }
+    memcpy(out, pool->bytes + pool->used, len);
+    pool->used += len;
+    return true;
+}
+
+// NOTE(ariel) The sockets of a resolver speak both families where the host
+// allows it, in which case IPv4 addresses travel mapped into IPv6.
+internal socklen_t
+peer_addr(Udp_Transport *udp, sockaddr_storage *addr, sockaddr_storage *peer)
+{
+    *peer = *addr;
+    if (udp->family == AF_INET6 && addr->ss_family == AF_INET) {
+        sockaddr_in *sa = (sockaddr_in *)addr;
+        sockaddr_in6 *mapped = (sockaddr_in6 *)peer;
+        *mapped = (sockaddr_in6){
+            .sin6_family = AF_INET6,
+            .sin6_port = sa->sin_port,
+        };
+        mapped->sin6_addr.s6_addr[10] = 0xff;
+        mapped->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&mapped->sin6_addr.s6_addr[12], &sa->sin_addr, sizeof(sa->sin_addr));
+    }
+    return peer->ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+}
+
+internal int
+open_socket(Udp_Transport *udp)
+{
+    int fd = socket(udp->family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    int no = 0;
+    if (udp->family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // NOTE(ariel) Pick the port at random rather than trust the kernel to.
+    // Leave it to the kernel after a few ports already in use.
+    sockaddr_storage addr = { .ss_family = udp->family };
+    for (u32 attempt = 0; attempt < UDP_BIND_ATTEMPTS; ++attempt) {
+        u16 port = 0;
+        if (!random_draw(&udp->random, &port, sizeof(port))) break;
+        port = htons(1024 + port % (UINT16_MAX - 1024));
+        if (udp->family == AF_INET) ((sockaddr_in *)&addr)->sin_port = port;
+        else ((sockaddr_in6 *)&addr)->sin6_port = port;
+        socklen_t socklen = udp->family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+        if (bind(fd, (sockaddr *)&addr, socklen) == 0) break;
+    }
+
+    // NOTE(ariel) Replies to every resolution in flight queue on these few
+    // sockets, so ask for deep buffers. The kernel caps them silently.
+    int size = MB(1);
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(udp->transport.fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+internal void
+close_socket(Udp_Transport *udp, int fd)
+{
+    if (fd == -1) return;
+    close(fd);
+    for (u32 i = 0; i < udp->ready_count; ++i) {
+        if (udp->ready[i] == fd) udp->ready[i--] = udp->ready[--udp->ready_count];
+    }
+}
+
+internal void
+rotate_socket(Udp_Transport *udp, Udp_Socket *socket, u64 now)
+{
+    int fd = open_socket(udp);
+    if (fd == -1) return;
+    close_socket(udp, socket->previous);
+    socket->previous = socket->current;
+    socket->current = fd;
+    socket->opened = now;
+}
+
+internal bool
+udp_send(Transport *t, u8 *msg, size_t len, sockaddr_storage *to)
+{
+    Udp_Transport *udp = (Udp_Transport *)t;
+    u8 slot = 0;
+    if (!random_draw(&udp->random, &slot, sizeof(slot))) return false;
+    slot %= UDP_SOCKET_COUNT;
+
+    Udp_Socket *socket = &udp->sockets[slot];
+    u64 now = stats_now();
+    if (now - socket->opened >= (u64)UDP_ROTATE_MS * 1000000) rotate_socket(udp, socket, now);
+
+    sockaddr_storage peer = {0};
+    socklen_t socklen = peer_addr(udp, to, &peer);
+    udp->slots[msg[0] << 8 | msg[1]] = slot;
+    return sendto(socket->current, msg, len, 0, (sockaddr *)&peer, socklen) != -1;
+}
+
+// NOTE(ariel) Accept a datagram only on the socket, current or previous, of
+// the slot its ID left from.
+internal bool
+expected_socket(Udp_Transport *udp, int fd, u8 *buf, ssize_t len)
+{
+    if (len < 2) return false;
+    Udp_Socket *socket = &udp->sockets[udp->slots[buf[0] << 8 | buf[1]]];
+    return fd == socket->current || fd == socket->previous;
+}
+
+internal ssize_t
+udp_recv(Transport *t, u8 *buf, size_t cap, sockaddr_storage *from)
+{
+    Udp_Transport *udp = (Udp_Transport *)t;
+    for (;;) {
+        while (udp->ready_count) {
+            int fd = udp->ready[udp->ready_count - 1];
+            socklen_t socklen = sizeof(*from);
+            ssize_t len = recvfrom(fd, buf, cap, 0, (sockaddr *)from, &socklen);
+            if (len == -1) {
+                --udp->ready_count;
+                continue;
+            }
+            if (!expected_socket(udp, fd, buf, len)) continue;
+
+            // NOTE(ariel) Unmap IPv4 addresses, so they compare equal to the
+            // ones the resolver sends to.
+            sockaddr_in6 *sa6 = (sockaddr_in6 *)from;
+            if (from->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&sa6->sin6_addr)) {
+                sockaddr_in sa = {
+                    .sin_family = AF_INET,
+                    .sin_port = sa6->sin6_port,
+                };
+                memcpy(&sa.sin_addr, &sa6->sin6_addr.s6_addr[12], sizeof(sa.sin_addr));
+                *from = (sockaddr_storage){0};
+                memcpy(from, &sa, sizeof(sa));
+            }
+            return len;
+        }
+
+        struct epoll_event events[2 * UDP_SOCKET_COUNT];
+        int n = epoll_wait(t->fd, events, 2 * UDP_SOCKET_COUNT, 0);
+        if (n <= 0) return -1;
+        for (int i = 0; i < n; ++i) udp->ready[udp->ready_count++] = events[i].data.fd;
+    }
+}
+
+internal u64
+udp_now(Transport *t)
+{
+    (void)t;
+    return stats_now();
+}
+
+internal bool
+udp_id(Transport *t, u16 *id)
+{
+    Udp_Transport *udp = (Udp_Transport *)t;
+    return random_draw(&udp->random, id, sizeof(*id));
+}
+
+internal void
+close_udp(Udp_Transport *udp)
+{
+    for (u32 i = 0; i < UDP_SOCKET_COUNT; ++i) {
+        if (udp->sockets[i].current != -1) close(udp->sockets[i].current);
+        if (udp->sockets[i].previous != -1) close(udp->sockets[i].previous);
+    }
+    if (udp->transport.fd != -1) close(udp->transport.fd);
+    free(udp);
+}
+
+// NOTE(ariel) The transport polls as a whole through its epoll descriptor.
+internal Udp_Transport *
+open_udp(void)
+{
+    Udp_Transport *udp = malloc(sizeof(Udp_Transport));
+    if (!udp) return 0;
+    *udp = (Udp_Transport){
+        .transport = {
+            .fd = epoll_create1(EPOLL_CLOEXEC),
+            .send = udp_send,
+            .recv = udp_recv,
+            .now = udp_now,
+            .id = udp_id,
+        },
+    };
+    for (u32 i = 0; i < UDP_SOCKET_COUNT; ++i) {
+        udp->sockets[i] = (Udp_Socket){ .current = -1, .previous = -1 };
+    }
+    if (udp->transport.fd == -1) {
+        close_udp(udp);
+        return 0;
+    }
+
+    // NOTE(ariel) Fall back to IPv4 alone on hosts without IPv6.
+    u64 now = stats_now();
+    udp->family = AF_INET6;
+    for (u32 i = 0; i < UDP_SOCKET_COUNT; ++i) {
+        int fd = open_socket(udp);
+        if (fd == -1 && !i && udp->family == AF_INET6) {
+            udp->family = AF_INET;
+            fd = open_socket(udp);
+        }
+        if (fd == -1) {
+            close_udp(udp);
+            return 0;
+        }
+        udp->sockets[i] = (Udp_Socket){ .current = fd, .previous = -1, .opened = now };
+    }
+    return udp;
+}
+
+
+/* ---
+ * Drive lookups.
+ * ---
+ */
+
+internal bool
+same_peer(sockaddr_storage *from, sockaddr_storage *addr)
+{
+    if (from->ss_family != addr->ss_family) return false;
+
+    if (addr->ss_family == AF_INET) {
+        sockaddr_in *a = (sockaddr_in *)from;
+        sockaddr_in *b = (sockaddr_in *)addr;
+        return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    } else {
+        sockaddr_in6 *a = (sockaddr_in6 *)from;
+        sockaddr_in6 *b = (sockaddr_in6 *)addr;
+        return a->sin6_port == b->sin6_port && !memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr));
+    }
+}
+
+internal inline u64
+now(Resolver *r)
+{
+    return r->transport->now(r->transport);
+}
+
+internal inline bool
+random_id(Resolver *r, u16 *id)
+{
+    return r->transport->id(r->transport, id);
+}
+
+internal bool
+send_query(Query_Template *template, Resolver *r, sockaddr_storage *addr, u16 id)
+{
+    // NOTE(ariel) Only the ID and the flags of a query change between hops of
+    // a resolution, so copy the rest of the message from the template.
+    u8 buf[UDP_MSG_LIMIT];
+    memcpy(buf, template->buf, template->len);
+
+    buf[0] = id >> 8;
+    buf[1] = id;
+    buf[2] = template->flags >> 8;
+    buf[3] = template->flags;
+
+    return r->transport->send(r->transport, buf, template->len, addr);
+}
+
+internal inline Frame *
+top_frame(Lookup *lookup)
+{
+    assert(lookup->depth);
+    return &lookup->frames[lookup->depth - 1];
+}
+
+internal void
+release_id(Lookup *lookup, u32 transmission)
+{
+    Resolver *r = lookup->resolver;
+    if (!(lookup->pending & 1u << transmission)) return;
+    lookup->pending &= ~(1u << transmission);
+    if (r->ids[lookup->ids[transmission]] == lookup) r->ids[lookup->ids[transmission]] = 0;
+    if (lookup->forward) forward_release(lookup->upstreams[transmission]);
+}
+
+internal void
+release_ids(Lookup *lookup)
+{
+    for (u32 i = 0; i < lookup->transmissions; ++i) release_id(lookup, i);
+    lookup->transmissions = 0;
+}
+
+internal i32
+find_transmission(Lookup *lookup, u16 id)
+{
+    for (u32 i = 0; i < lookup->transmissions; ++i) {
+        if (lookup->ids[i] == id) return i;
+    }
+    return -1;
+}
+
+internal void
+complete(Lookup *lookup, Resolution resolution)
+{
+    Resolver *r = lookup->resolver;
+    release_ids(lookup);
+    timer_cancel(&r->timers, &lookup->retransmit);
+    timer_cancel(&r->timers, &lookup->deadline);
+
+    // NOTE(ariel) Recycle the lookup before the callback runs, since the
+    // callback may well start another resolution.
+    Resolve_Callback callback = lookup->callback;
+    void *user = lookup->user;
+    lookup->next = r->free;
+    r->free = lookup;
+    --r->active;
+
+    callback(user, &resolution);
+}
+
+internal void
+transmit(Lookup *lookup)
+{
+    Resolver *r = lookup->resolver;
+    Frame *frame = top_frame(lookup);
+
+    if (lookup->transmissions == DNS_TRANSMIT_LIMIT) {
+        end_frame(lookup, lookup->failure);
+        return;
+    }
+
+    u16 id = 0;
+    do {
+        if (!random_id(r, &id)) {
+            end_frame(lookup, (Resolution){ .status = DNS_ERR_NETWORK });
+            return;
+        }
+    } while (r->ids[id]);
+    u32 attempt = lookup->transmissions;
+    r->ids[id] = lookup;
+    lookup->ids[lookup->transmissions++] = id;
+    lookup->pending |= 1u << attempt;
+
+    u64 start = stats_now();
+    u64 clock = now(r);
+    if (lookup->forward) {
+        i32 upstream = forward_pick(lookup->tried, &frame->addr);
+        lookup->tried |= 1u << upstream;
+        lookup->upstreams[attempt] = upstream;
+        lookup->times[attempt] = clock;
+    }
+    if (!send_query(&lookup->template, r, &frame->addr, id)) {
+        end_frame(lookup, (Resolution){ .status = DNS_ERR_NETWORK });
+        return;
+    }
+    stats_record(STAT_STAGE_SEND, start);
+    stats_count(STAT_QUERIES_SENT);
+    TRACE(TRACE_QUERY_SENT, lookup->forward ? TRACE_REASON_FORWARD : TRACE_REASON_NONE, &frame->addr, intern_lookup_text(&g_names, lookup->template.name), 0,
+            lookup->template.qtype, id, attempt, 0);
+
+    lookup->sent = start;
+    timer_start(&r->timers, &lookup->retransmit, clock, r->retransmit);
+}
+
+// NOTE(ariel) Query the nameserver of the top frame, which counts as one hop.
+internal void
+query_frame(Lookup *lookup)
+{
+    Frame *frame = top_frame(lookup);
+    if (frame->hops++ == DNS_HOP_LIMIT) {
+        end_frame(lookup, (Resolution){ .status = DNS_ERR_HOP_LIMIT });
+        return;
+    }
+
+    release_ids(lookup);
+    lookup->failure = (Resolution){ .status = DNS_ERR_TIMEOUT };
+    if (lookup->template.name != frame->name || lookup->template.qtype != frame->qtype)
+        lookup->template = compile_query(frame->name, frame->qtype, lookup->forward ? DNS_HEADER_FLAG_RD : 0);
+    transmit(lookup);
+}
+
+// NOTE(ariel) Hand the outcome of the frame that just ended to the frame
+// below it, or to the callback if none remains.
+internal void
+deliver(Lookup *lookup, Resolution resolution)
+{
+    if (!lookup->depth) {
+        complete(lookup, resolution);
+        return;
+    }
+
+    Frame *frame = top_frame(lookup);
+    if (resolution.status) {
+        end_frame(lookup, resolution);
+        return;
+    }
+
+    Resource_Record *rr = find_resource_record(resolution.answer, frame->ns);
+    if (!rr) {
+        end_frame(lookup, (Resolution){ .status = DNS_ERR_NO_NAMESERVER });
+        return;
+    }
+
+    decode_ip(rr, &frame->addr);
+    frame->cut = frame->zone;
+    remember_delegation(frame->zone, frame->ns_ttl, rr);
+    TRACE(TRACE_REFERRAL, TRACE_REASON_GLUELESS, &frame->addr, intern_lookup_text(&g_names, frame->ns), 0, 0, 0, 0, 0);
+    query_frame(lookup);
+}
+
+internal void
+end_frame(Lookup *lookup, Resolution resolution)
+{
+    Resolver *r = lookup->resolver;
+    Frame *frame = top_frame(lookup);
+
+    release_ids(lookup);
+    timer_cancel(&r->timers, &lookup->retransmit);
+    stats_record(STAT_STAGE_RESOLVE, frame->start);
+    trace_end(frame->previous, frame->start, resolution.rcode, resolution.answer.count);
+    lookup->span = t_trace;
+    --lookup->depth;
+
+    deliver(lookup, resolution);
+}
+
+internal void
+begin_frame(Lookup *lookup, Name_ID name, u16 qtype)
+{
+    Resolution resolution = {0};
+
+
+    /* ---
+     * Answer from local overrides or the cache if possible.
+     * ---
+     */
+    if (hosts_lookup(name, qtype, &resolution)) {
+        deliver(lookup, resolution);
+        return;
+    }
+    if (t_cache || g_shared_cache) {
+        if (cache_find(name, qtype, &resolution.rcode, &resolution.answer)) {
+            stats_count(STAT_CACHE_HITS);
+            deliver(lookup, resolution);
+            return;
+        }
+        stats_count(STAT_CACHE_MISSES);
+    }
+
+    if (lookup->depth == DNS_DEPTH_LIMIT) {
+        end_frame(lookup, (Resolution){ .status = DNS_ERR_HOP_LIMIT });
+        return;
+    }
+
+
+    /* ---
+     * Otherwise iterate from the closest known zone cut or the root.
+     * ---
+     */
+    Frame *frame = &lookup->frames[lookup->depth++];
+    *frame = (Frame){
+        .name = name,
+        .qtype = qtype,
+        .addr = { .ss_family = AF_INET },
+        .start = stats_now(),
+    };
+    frame->previous = trace_begin(intern_lookup_text(&g_names, name), qtype);
+    lookup->span = t_trace;
+
+    // NOTE(ariel) Leave iteration to the upstreams in forwarding mode. The
+    // query goes to whichever upstream the pool picks for it.
+    if (forward_enabled()) {
+        lookup->forward = true;
+        query_frame(lookup);
+        return;
+    }
+
+    frame->cut = find_delegation(name, &frame->addr);
+    if (!frame->cut) {
+        // NOTE(ariel) Take the referral of the root from its local copy if
+        // one exists, which also knows every TLD that does not exist.
+        String ns = {0};
+        String wire = intern_lookup_wire(&g_names, name);
+        Root_Zone_Answer local = root_zone_refer(wire, &frame->addr, &ns);
+        if (local == ROOT_ZONE_NXDOMAIN) {
+            end_frame(lookup, (Resolution){ .rcode = DNS_RCODE_NXDOMAIN });
+            return;
+        } else if (local == ROOT_ZONE_REFERRAL) {
+            size_t tld = 0;
+            for (size_t i = 0; wire.str[i]; i += 1 + wire.str[i]) tld = i;
+            frame->cut = intern_wire(&g_names, (String){ .str = wire.str + tld, .len = wire.len - tld });
+            TRACE(TRACE_REFERRAL, TRACE_REASON_ROOT_ZONE, &frame->addr, ns, 0, 0, 0, 0, 0);
+        } else {
+            encode_ip(ROOT_SERVER_A_IPv4, &frame->addr);
+        }
+    }
+    query_frame(lookup);
+}
+
+// NOTE(ariel) Give up on a transmission that its upstream failed, along with
+// its ID, so a duplicate of the failed reply counts no more. Try another
+// upstream while transmissions remain, or else end the frame as soon as no
+// other transmission may still bring an answer. Until then, the timer of the
+// last transmission bounds the wait.
+internal void
+fail_upstream(Lookup *lookup, i32 transmission, Resolution failure)
+{
+    Resolver *r = lookup->resolver;
+    stats_count(STAT_FAILOVERS);
+    forward_failure(lookup->upstreams[transmission]);
+    release_id(lookup, transmission);
+    lookup->failure = failure;
+
+    if (lookup->transmissions < DNS_TRANSMIT_LIMIT) {
+        timer_cancel(&r->timers, &lookup->retransmit);
+        transmit(lookup);
+    } else if (!lookup->pending) {
+        end_frame(lookup, failure);
+    }
+}
+
+// NOTE(ariel) An upstream answers with the final reply or fails outright, and
+// the lookup then tries another one, up to the limit of transmissions. Only a
+// usable reply counts toward the health of the upstream it came from.
+internal void
+follow_upstream(Lookup *lookup, DNS_Reply *reply, i32 transmission)
+{
+    Resolver *r = lookup->resolver;
+    Frame *frame = top_frame(lookup);
+    i32 upstream = lookup->upstreams[transmission];
+    u16 rcode = reply->header.flags & DNS_HEADER_MASK_R;
+    bool recursive = reply->header.flags & (DNS_HEADER_FLAG_RA | DNS_HEADER_FLAG_AA);
+
+    if (rcode == DNS_RCODE_NOERROR || rcode == DNS_RCODE_NXDOMAIN) {
+        if (recursive) {
+            Resolution resolution = {
+                .rcode = rcode,
+                .answer = reply->answer,
+            };
+            forward_success(upstream, now(r) - lookup->times[transmission]);
+            cache_remember(frame->name, frame->qtype, rcode, reply->answer, answer_ttl(reply));
+            end_frame(lookup, resolution);
+            return;
+        }
+    }
+
+    if (recursive) fail_upstream(lookup, transmission, (Resolution){ .rcode = rcode });
+    else fail_upstream(lookup, transmission, (Resolution){ .status = DNS_ERR_NO_NAMESERVER });
+}
+
+internal void
+follow(Lookup *lookup, DNS_Reply *reply)
+{
+    Frame *frame = top_frame(lookup);
+    u64 iterate = stats_now();
+
+    if (reply->header.flags & DNS_HEADER_FLAG_AA) {
+        Resolution resolution = {
+            .rcode = reply->header.flags & DNS_HEADER_MASK_R,
+            .answer = reply->answer,
+        };
+        cache_remember(frame->name, frame->qtype, resolution.rcode, reply->answer, answer_ttl(reply));
+        end_frame(lookup, resolution);
+    } else if (reply->header.nscount) {
+        stats_count(STAT_REFERRALS);
+
+        Resource_Record *ns = 0;
+        Resource_Record *glue = 0;
+
+        for (u32 i = 0; i < reply->authority.count && !glue; ++i) {
+            // NOTE(ariel) Only follow a delegation to the name or one of its
+            // ancestors strictly below the zone just queried, so a server
+            // cannot claim zones outside its own.
+            Resource_Record *rr = &reply->authority.rrs[i];
+            if (rr->type != RR_TYPE_NS) continue;
+            if (rr->owner == frame->cut || !in_bailiwick(rr->owner, frame->cut)) continue;
+            if (!in_bailiwick(frame->name, rr->owner)) continue;
+            ns = rr;
+
+            // NOTE(ariel) Match resource record from authority section to
+            // record from additional section to map domain name to IP
+            // address. Trust glue only within the zone just queried, and
+            // otherwise resolve the address of the nameserver on its own.
+            glue = find_resource_record(reply->additional, rr->rdata.name);
+            if (glue && !in_bailiwick(glue->owner, frame->cut)) glue = 0;
+        }
+        stats_record(STAT_STAGE_ITERATE, iterate);
+
+        if (glue) {
+            decode_ip(glue, &frame->addr);
+            frame->cut = ns->owner;
+            remember_delegation(ns->owner, ns->ttl, glue);
+            TRACE(TRACE_REFERRAL, TRACE_REASON_GLUE, &frame->addr, intern_lookup_text(&g_names, glue->owner), 0,
+                    reply->authority.count, reply->additional.count, 0, 0);
+            query_frame(lookup);
+        } else if (ns) {
+            // NOTE(ariel) If no match exists between NS and A, resolve IP from
+            // hostname of some nameserver in a frame of its own to then query
+            // it.
+            frame->ns = ns->rdata.name;
+            frame->zone = ns->owner;
+            frame->ns_ttl = ns->ttl;
+            release_ids(lookup);
+            timer_cancel(&lookup->resolver->timers, &lookup->retransmit);
+            begin_frame(lookup, ns->rdata.name, RR_TYPE_A);
+        } else {
+            end_frame(lookup, (Resolution){ .status = DNS_ERR_NO_NAMESERVER });
+        }
+    } else {
+        end_frame(lookup, (Resolution){ .status = DNS_ERR_NO_NAMESERVER });
+    }
+}
+
+internal void
+on_retransmit(Timer *timer)
+{
+    Lookup *lookup = timer->data;
+    Trace_Span outer = t_trace;
+    t_trace = lookup->span;
+
+    Frame *frame = top_frame(lookup);
+    stats_count(STAT_TIMEOUTS);
+    TRACE(TRACE_TIMEOUT, TRACE_REASON_NONE, &frame->addr, (String){0}, stats_now() - lookup->sent, 0, 0, 0, 0);
+    // NOTE(ariel) The last transmission may have failed already, and then
+    // counted against its upstream.
+    u32 last = lookup->transmissions - 1;
+    if (lookup->forward && lookup->pending & 1u << last) forward_failure(lookup->upstreams[last]);
+    transmit(lookup);
+
+    t_trace = outer;
+}
+
+internal void
+on_deadline(Timer *timer)
+{
+    Lookup *lookup = timer->data;
+    Trace_Span outer = t_trace;
+    t_trace = lookup->span;
+
+    // NOTE(ariel) Abandon every frame of the lookup at once.
+    stats_count(STAT_TIMEOUTS);
+    TRACE(TRACE_TIMEOUT, TRACE_REASON_NONE, &top_frame(lookup)->addr, (String){0}, 0, 0, 0, 0, 0);
+    end_frame(lookup, (Resolution){ .status = DNS_ERR_TIMEOUT });
+
+    t_trace = outer;
+}
+
+internal void
+receive(Resolver *r, u8 *buf, size_t len, sockaddr_storage *from)
+{
+    // NOTE(ariel) Ignore any datagram that does not come from the nameserver
+    // a pending query went to, including late replies to lookups that ended.
+    if (len < 2) return;
+    u16 id = buf[0] << 8 | buf[1];
+    Lookup *lookup = r->ids[id];
+    if (!lookup) return;
+
+    i32 transmission = find_transmission(lookup, id);
+    i32 upstream = lookup->forward ? lookup->upstreams[transmission] : -1;
+    sockaddr_storage *addr = lookup->forward ? forward_addr(upstream) : &top_frame(lookup)->addr;
+    if (!same_peer(from, addr)) return;
+
+    Trace_Span outer = t_trace;
+    t_trace = lookup->span;
+    stats_record(STAT_STAGE_WAIT, lookup->sent);
+
+    u64 start = stats_now();
+    String msg = {
         .str = arena_alloc(&g_arena, len),
         .len = len,
     };
-    if (recvfrom(sockfd, buf.str, buf.len, 0, (sockaddr *)&addr, &socklen) == -1)
-        err_exit("failed to read received message");
+    memcpy(msg.str, buf, len);
 
-    return parse_reply(buf);
+    DNS_Reply reply = {0};
+    Frame *frame = top_frame(lookup);
+    if (!parse_reply(&reply, msg)) {
+        stats_count(STAT_MALFORMED_REPLIES);
+        TRACE(TRACE_REPLY_MALFORMED, TRACE_REASON_NONE, &frame->addr, (String){0}, 0, msg.len, 0, 0, 0);
+        // NOTE(ariel) Fail over from an upstream that garbles a reply as from
+        // one that fails it. Otherwise drop the reply, which may have been
+        // corrupted on its way, and let a retransmission fetch another one.
+        if (lookup->forward) fail_upstream(lookup, transmission, (Resolution){ .status = DNS_ERR_MALFORMED });
+        else lookup->failure = (Resolution){ .status = DNS_ERR_MALFORMED };
+    } else if (reply.question.name == lookup->template.name && reply.question.qtype == lookup->template.qtype) {
+        stats_record(STAT_STAGE_PARSE, start);
+        TRACE(TRACE_REPLY_RECEIVED, TRACE_REASON_NONE, addr, reply.question.domain, stats_now() - lookup->sent,
+                reply.header.flags & DNS_HEADER_MASK_R, reply.header.flags, id, 0);
+        if (lookup->forward) follow_upstream(lookup, &reply, transmission);
+        else follow(lookup, &reply);
+    }
+
+    t_trace = outer;
 }
 
-internal DNS_Reply
-query(char *server, sockaddr_storage addr, String hostname)
+Resolver *
+resolver_create_on(Transport *transport)
 {
-    int sockfd = socket(addr.ss_family, SOCK_DGRAM, 0);
-    if (sockfd == -1) err_exit("failed to open socket");
+    Resolver *r = calloc(1, sizeof(Resolver));
+    Lookup **ids = calloc(1 << 16, sizeof(Lookup *));
+    if (!r || !ids) {
+        free(ids);
+        free(r);
+        return 0;
+    }
 
-    struct timeval timeout = { .tv_sec = 1 };
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
-        err_exit("failed to set timeout option for socket");
+    r->ids = ids;
+    r->retransmit = (u64)DNS_RETRANSMIT_MS * 1000000;
+    r->transport = transport;
+    return r;
+}
 
-    encode_ip(server, &addr);
+Resolver *
+resolver_create(void)
+{
+    Resolver *r = resolver_create_on(0);
+    if (r && !(r->udp = open_udp())) {
+        resolver_destroy(r);
+        return 0;
+    }
+    if (r) r->transport = &r->udp->transport;
+    return r;
+}
 
-    send_query(init_query(hostname, addr.ss_family), sockfd, addr);
-    DNS_Reply reply = recv_reply(sockfd, addr);
+void
+resolver_set_retransmit(Resolver *r, u64 ns)
+{
+    r->retransmit = ns;
+}
 
-    close(sockfd);
-    return reply;
+void
+resolver_destroy(Resolver *r)
+{
+    if (!r) return;
+    for (Lookup *lookup = r->all, *next = 0; lookup; lookup = next) {
+        next = lookup->all;
+        free(lookup);
+    }
+    if (r->udp) close_udp(r->udp);
+    free(r->ids);
+    free(r);
 }
 
-internal Resource_Record *
-find_resource_record(Resource_Record_List rs, String name)
+DNS_Status
+resolver_start(Resolver *r, Name_ID name, u16 qtype, Resolve_Callback callback, void *user)
 {
-    Resource_Record_Link *link = 0;
+    if (r->active == DNS_ACTIVE_LIMIT) return DNS_ERR_BUSY;
+
+    Lookup *lookup = r->free;
+    if (lookup) {
+        r->free = lookup->next;
+    } else {
+        lookup = malloc(sizeof(Lookup));
+        if (!lookup) return DNS_ERR_BUSY;
+        lookup->all = r->all;
+        r->all = lookup;
+    }
+
+    Lookup *all = lookup->all;
+    *lookup = (Lookup){
+        .resolver = r,
+        .all = all,
+        .retransmit = { .expire = on_retransmit, .data = lookup },
+        .deadline = { .expire = on_deadline, .data = lookup },
+        .callback = callback,
+        .user = user,
+    };
+    ++r->active;
+    timer_start(&r->timers, &lookup->deadline, now(r), (u64)DNS_RESOLUTION_MS * 1000000);
+
+    Trace_Span outer = t_trace;
+    t_trace = lookup->span;
+    begin_frame(lookup, name, qtype);
+    t_trace = outer;
 
-    link = rs.A;
-    while (link) {
-        Resource_Record *rr = &link->rr;
-        if (string_cmp(rr->name, name)) return rr;
-        link = link->next;
+    return DNS_OK;
+}
+
+int
+resolver_fd(Resolver *r)
+{
+    return r->transport->fd;
+}
+
+i64
+resolver_timeout(Resolver *r)
+{
+    return timer_next(&r->timers, now(r));
+}
+
+void
+resolver_process(Resolver *r)
+{
+    for (;;) {
+        sockaddr_storage from = {0};
+        ssize_t len = r->transport->recv(r->transport, r->buf, sizeof(r->buf), &from);
+        if (len == -1) break;
+        receive(r, r->buf, len, &from);
     }
 
-    link = rs.AAAA;
-    while (link) {
-        Resource_Record *rr = &link->rr;
-        if (string_cmp(rr->name, name)) return rr;
-        link = link->next;
+    timer_advance(&r->timers, now(r));
+}
+
+internal void
+store_resolution(void *user, Resolution *resolution)
+{
+    Resolution *result = user;
+    *result = *resolution;
+}
+
+Resolution
+resolve(String domain, u16 qtype)
+{
+    Name_ID name = intern_text(&g_names, domain);
+    if (!name) return (Resolution){ .status = DNS_ERR_INVALID_NAME };
+
+    if (!t_resolver) t_resolver = resolver_create();
+    if (!t_resolver) return (Resolution){ .status = DNS_ERR_NETWORK };
+
+    // NOTE(ariel) No resolution ever ends with this status, so it marks the
+    // resolution as still in flight.
+    Resolution resolution = { .status = DNS_STATUS_COUNT };
+    DNS_Status status = resolver_start(t_resolver, name, qtype, store_resolution, &resolution);
+    if (status) return (Resolution){ .status = status };
+
+    while (resolution.status == DNS_STATUS_COUNT) {
+        i64 wait = resolver_timeout(t_resolver);
+        int timeout = wait < 0 ? -1 : (wait + 999999) / 1000000;
+        struct pollfd pollfd = { .fd = resolver_fd(t_resolver), .events = POLLIN };
+        (void)poll(&pollfd, 1, timeout);
+        resolver_process(t_resolver);
     }
 
+    return resolution;
+}
+
+void
+resolve_release(void)
+{
+    resolver_destroy(t_resolver);
+    t_resolver = 0;
+}
+
+u16
+rr_type_from_string(String s)
+{
+    for (u16 type = 0; type < sizeof(RR_TYPE_STRING) / sizeof(*RR_TYPE_STRING); ++type) {
+        char *name = RR_TYPE_STRING[type];
+        if (name && string_cmp_nocase(s, (String){ .str = (u8 *)name, .len = strlen(name) })) return type;
+    }
     return 0;
 }
 
-Resource_Record_List
-resolve(String domain)
+bool
+rr_rdata_is_raw(u16 type)
 {
-    char *ip = ROOT_SERVER_A_IPv4;
-    sockaddr_storage addr = { .ss_family = AF_INET };
+    switch (type) {
+        case RR_TYPE_A:
+        case RR_TYPE_AAAA:
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR:
+        case RR_TYPE_MX:
+        case RR_TYPE_SRV:
+        case RR_TYPE_SOA:
+            return false;
+        default:
+            return true;
+    }
+}
 
-    for (;;) {
-        Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
-        DNS_Reply reply = query(ip, addr, domain);
-
-        if (reply.header.flags & DNS_HEADER_FLAG_AA) {
-            return reply.answer;
-        } else if (reply.header.nscount) {
-            Resource_Record_Link *link = reply.authority.NS;
-
-            while (link) {
-                String rr_domain = {
-                    .str = link->rr.rdata,
-                    .len = link->rr.rdlength,
-                };
+char *
+rr_type_to_string(u16 type)
+{
+    if (type < sizeof(RR_TYPE_STRING) / sizeof(*RR_TYPE_STRING) && RR_TYPE_STRING[type])
+        return RR_TYPE_STRING[type];
+    return "UNKNOWN";
+}
 
-                // NOTE(ariel) Match resource record from authority section to
-                // record from additional section to map domain name to IP
-                // address.
-                Resource_Record *rr = find_resource_record(reply.additional, rr_domain);
-                if (rr) {
-                    assert(rr->type == RR_TYPE_A || rr->type == RR_TYPE_AAAA);
-                    addr.ss_family = rr->type == RR_TYPE_A ? AF_INET : AF_INET6;
-                    ip = (char *)rr->rdata;
-                    break;
-                }
+bool
+format_rdata(String *rdata, Resource_Record *rr)
+{
+    *rdata = (String){0};
 
-                link = link->next;
-            }
+    // NOTE(ariel) Escaping text expands a byte to at most four characters.
+    size_t cap = 4 * (size_t)rr->rdlength + 2 * DNS_DOMAIN_LIMIT + 64;
+    char *buf = arena_alloc(&g_arena, cap);
 
-            // NOTE(ariel) If no match exists between NS and A, query the name
-            // server using its domain or hostname.
-            if (!link) {
-                if (reply.authority.NS) {
-                    Resource_Record *rr = &reply.authority.NS->rr;
-                    String nameserver_domain = {
-                        .str = rr->rdata,
-                        .len = rr->rdlength,
-                    };
-
-                    // NOTE(ariel) Recursively resolve IP from hostname of some
-                    // nameserver to then query it.
-                    Resource_Record_List nameserver = resolve(nameserver_domain);
-                    if (nameserver.A) {
-                        Resource_Record *rr = &nameserver.A->rr;
-                        ip = string_term((String){ .str = rr->rdata, .len = rr->rdlength });
-                    } else if (nameserver.AAAA) {
-                        Resource_Record *rr = &nameserver.A->rr;
-                        ip = string_term((String){ .str = rr->rdata, .len = rr->rdlength });
-                    } else err_exit("unable to recursively resolve domain name of nameserver");
-                } else err_exit("DNS reply does not contain expected NS record");
-            }
-        } else err_exit("DNS reply does not contain any NS records");
+    Resource_Record_Data *d = &rr->rdata;
+    int len = 0;
 
-        arena_checkpoint_restore(cp);
+    switch (rr->type) {
+        case RR_TYPE_A: {
+            if (inet_ntop(AF_INET, d->a, buf, cap)) len = strlen(buf);
+            break;
+        }
+        case RR_TYPE_AAAA: {
+            if (inet_ntop(AF_INET6, d->aaaa, buf, cap)) len = strlen(buf);
+            break;
+        }
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR: {
+            String name = intern_lookup_text(&g_names, d->name);
+            len = snprintf(buf, cap, "%.*s", (int)name.len, name.str);
+            break;
+        }
+        case RR_TYPE_MX: {
+            String name = intern_lookup_text(&g_names, d->mx.exchange);
+            len = snprintf(buf, cap, "%u %.*s", d->mx.preference, (int)name.len, name.str);
+            break;
+        }
+        case RR_TYPE_SRV: {
+            String name = intern_lookup_text(&g_names, d->srv.target);
+            len = snprintf(buf, cap, "%u %u %u %.*s",
+                    d->srv.priority, d->srv.weight, d->srv.port, (int)name.len, name.str);
+            break;
+        }
+        case RR_TYPE_SOA: {
+            String mname = intern_lookup_text(&g_names, d->soa.mname);
+            String rname = intern_lookup_text(&g_names, d->soa.rname);
+            len = snprintf(buf, cap, "%.*s %.*s %u %u %u %u %u",
+                    (int)mname.len, mname.str, (int)rname.len, rname.str,
+                    d->soa.serial, d->soa.refresh, d->soa.retry, d->soa.expire, d->soa.minimum);
+            break;
+        }
+        case RR_TYPE_TXT: {
+            // NOTE(ariel) Print each character-string in quotes and escape
+            // any character that is not printable.
+            for (u16 i = 0; i < rr->rdlength;) {
+                u8 n = d->raw[i++];
+                if (len) buf[len++] = ' ';
+                buf[len++] = '"';
+                for (u8 j = 0; j < n && i < rr->rdlength; ++j, ++i) {
+                    u8 c = d->raw[i];
+                    int escape = 0;
+                    if (c == '"' || c == '\\') escape = snprintf(buf + len, cap - len, "\\%c", c);
+                    else if (c < 0x20 || c >= 0x7f) escape = snprintf(buf + len, cap - len, "\\%03u", c);
+                    else buf[len++] = c;
+                    if (escape < 0) return false;
+                    len += escape;
+                }
+                buf[len++] = '"';
+            }
+            break;
+        }
+        default: {
+            // NOTE(ariel) Print unknown types in the generic form of RFC 3597.
+            len = snprintf(buf, cap, "\\# %u ", rr->rdlength);
+            for (u16 i = 0; i < rr->rdlength && len >= 0; ++i) {
+                int digits = snprintf(buf + len, cap - len, "%02x", d->raw[i]);
+                len = digits < 0 ? digits : len + digits;
+            }
+            break;
+        }
     }
+
+    if (len < 0) return false;
+    assert((size_t)len <= cap);
+    rdata->str = arena_realloc(&g_arena, len);
+    rdata->len = len;
+    return true;
 }
 
 void
-output_address(Resource_Record_List rs)
+output_answer(Resource_Record_Array rs)
 {
-    if (rs.A) {
-        Resource_Record *rr = &rs.A->rr;
-        fprintf(stdout, "(%s) %.*s %.*s\n",
-                RR_TYPE_STRING[rr->type],
-                (int)rr->name.len, rr->name.str,
-                (int)rr->rdlength, rr->rdata);
-    } else if (rs.AAAA) {
-        Resource_Record *rr = &rs.AAAA->rr;
+    if (!rs.count) err_exit("DNS reply does not contain any answers");
+
+    for (u32 i = 0; i < rs.count; ++i) {
+        Resource_Record *rr = &rs.rrs[i];
+        String name = intern_lookup_text(&g_names, rr->owner);
+        String rdata = {0};
+        if (!format_rdata(&rdata, rr)) err_exit("failed to format rdata of resource record");
         fprintf(stdout, "(%s) %.*s %.*s\n",
-                RR_TYPE_STRING[rr->type],
-                (int)rr->name.len, rr->name.str,
-                (int)rr->rdlength, rr->rdata);
-    } else err_exit("unable to map hostname to IP address");
+                rr_type_to_string(rr->type),
+                (int)name.len, name.str,
+                (int)rdata.len, rdata.str);
+    }
 }
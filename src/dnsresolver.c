@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "dnsresolver.h"
+#include "intern.h"
+
+// NOTE(ariel) The resolver keeps its state in thread-local variables, i.e.
+// the arena, the table of names and the cache of the thread. A context
+// carries its own set of them instead and installs them for the duration of
+// every call into the library, so any thread may drive any context, and an
+// application may drive several of them from one thread.
+
+enum {
+    CONTEXT_CACHE_CAPACITY = 1 << 14,
+    CONTEXT_CACHE_LIMIT    = MB(16),
+};
+
+typedef struct Request Request;
+struct Request {
+    Request *next;
+    Request *all;
+    DNS_Context *ctx;
+    Name_ID name;
+    u16 type;
+    DNS_Callback callback;
+    void *user;
+};
+
+struct DNS_Context {
+    Resolver *resolver;
+    Arena arena;
+    Intern_Table names;
+    Cache cache;
+    Request *free;
+    Request *all;
+
+    // NOTE(ariel) A callback may call into the library again, in which case
+    // the state of the context is already in place.
+    u32 depth;
+    Arena saved_arena;
+    Intern_Table saved_names;
+    Cache *saved_cache;
+};
+
+internal void
+enter(DNS_Context *ctx)
+{
+    if (ctx->depth++) return;
+
+    ctx->saved_arena = g_arena;
+    ctx->saved_names = g_names;
+    ctx->saved_cache = t_cache;
+    g_arena = ctx->arena;
+    g_names = ctx->names;
+    t_cache = &ctx->cache;
+}
+
+internal void
+leave(DNS_Context *ctx)
+{
+    if (--ctx->depth) return;
+
+    ctx->arena = g_arena;
+    ctx->names = g_names;
+    g_arena = ctx->saved_arena;
+    g_names = ctx->saved_names;
+    t_cache = ctx->saved_cache;
+}
+
+internal char *
+terminate(String s)
+{
+    char *text = arena_alloc(&g_arena, s.len + 1);
+    memcpy(text, s.str, s.len);
+    text[s.len] = 0;
+    return text;
+}
+
+internal void
+report(void *user, Resolution *resolution)
+{
+    Request *request = user;
+    DNS_Context *ctx = request->ctx;
+
+    DNS_Result result = {
+        .name = terminate(intern_lookup_text(&g_names, request->name)),
+        .type = request->type,
+        .status = resolution->status,
+        .rcode = resolution->rcode,
+    };
+    if (!resolution->status) {
+        DNS_Record *records = arena_alloc(&g_arena, resolution->answer.count * sizeof(DNS_Record));
+        for (u32 i = 0; i < resolution->answer.count; ++i) {
+            Resource_Record *rr = &resolution->answer.rrs[i];
+            String rdata = {0};
+            (void)format_rdata(&rdata, rr);
+            records[i] = (DNS_Record){
+                .owner = terminate(intern_lookup_text(&g_names, rr->owner)),
+                .type = rr->type,
+                .ttl = MAX(rr->ttl, 0),
+                .data = terminate(rdata),
+            };
+        }
+        result.count = resolution->answer.count;
+        result.records = records;
+    }
+
+    // NOTE(ariel) Recycle the request first, so the callback may reuse it.
+    DNS_Callback callback = request->callback;
+    void *caller = request->user;
+    request->next = ctx->free;
+    ctx->free = request;
+
+    callback(caller, &result);
+}
+
+DNS_Context *
+dns_context_create(void)
+{
+    DNS_Context *ctx = calloc(1, sizeof(DNS_Context));
+    if (!ctx) return 0;
+
+    ctx->resolver = resolver_create();
+    if (!ctx->resolver) {
+        free(ctx);
+        return 0;
+    }
+
+    arena_init(&ctx->arena);
+    intern_init(&ctx->names);
+    cache_init(&ctx->cache, CONTEXT_CACHE_CAPACITY, CONTEXT_CACHE_LIMIT);
+    return ctx;
+}
+
+void
+dns_context_destroy(DNS_Context *ctx)
+{
+    if (!ctx) return;
+
+    for (Request *request = ctx->all, *next = 0; request; request = next) {
+        next = request->all;
+        free(request);
+    }
+
+    resolver_destroy(ctx->resolver);
+    cache_release(&ctx->cache);
+    intern_release(&ctx->names);
+    arena_release(&ctx->arena);
+    free(ctx);
+}
+
+DNS_Status
+resolve_async(DNS_Context *ctx, const char *name, uint16_t type, DNS_Callback callback, void *user)
+{
+    Request *request = ctx->free;
+    if (request) {
+        ctx->free = request->next;
+    } else {
+        request = malloc(sizeof(Request));
+        if (!request) return DNS_ERR_BUSY;
+        request->all = ctx->all;
+        ctx->all = request;
+    }
+    *request = (Request){
+        .all = request->all,
+        .ctx = ctx,
+        .type = type,
+        .callback = callback,
+        .user = user,
+    };
+
+    enter(ctx);
+    Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+
+    DNS_Status status = DNS_ERR_INVALID_NAME;
+    request->name = intern_text(&g_names, (String){ .str = (u8 *)name, .len = strlen(name) });
+    if (request->name) status = resolver_start(ctx->resolver, request->name, type, report, request);
+    if (status) {
+        request->next = ctx->free;
+        ctx->free = request;
+    }
+
+    arena_checkpoint_restore(cp);
+    leave(ctx);
+    return status;
+}
+
+int
+dns_context_fd(DNS_Context *ctx)
+{
+    return resolver_fd(ctx->resolver);
+}
+
+int
+dns_context_timeout(DNS_Context *ctx)
+{
+    i64 wait = resolver_timeout(ctx->resolver);
+    return wait < 0 ? -1 : (int)((wait + 999999) / 1000000);
+}
+
+void
+dns_context_process(DNS_Context *ctx)
+{
+    enter(ctx);
+    Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+    resolver_process(ctx->resolver);
+    arena_checkpoint_restore(cp);
+    leave(ctx);
+}
+
+const char *
+dns_status_string(DNS_Status status)
+{
+    return status < DNS_STATUS_COUNT ? DNS_STATUS_STRING[status] : "unknown status";
+}
+
+uint16_t
+dns_type_from_string(const char *type)
+{
+    return rr_type_from_string((String){ .str = (u8 *)type, .len = strlen(type) });
+}
+
+const char *
+dns_type_to_string(uint16_t type)
+{
+    return rr_type_to_string(type);
+}
@@ -0,0 +1,32 @@
+#include <sched.h>
+
+#include "common.h"
+#include "epoch.h"
+
+u32
+epoch_enter(Epoch *e)
+{
+    u32 parity = __atomic_load_n(&e->epoch, __ATOMIC_RELAXED) & 1;
+    __atomic_add_fetch(&e->readers[parity], 1, __ATOMIC_RELAXED);
+
+    // NOTE(ariel) Pairs with the fence of `epoch_wait()`: either the reader
+    // loads the replacement or the writer sees the reader.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return parity;
+}
+
+void
+epoch_exit(Epoch *e, u32 parity)
+{
+    __atomic_sub_fetch(&e->readers[parity], 1, __ATOMIC_RELEASE);
+}
+
+void
+epoch_wait(Epoch *e)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (u32 i = 0; i < 2; ++i) {
+        u64 previous = __atomic_fetch_add(&e->epoch, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&e->readers[previous & 1], __ATOMIC_ACQUIRE)) sched_yield();
+    }
+}
@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "forward.h"
+#include "stats.h"
+
+enum {
+    FORWARD_FAILURE_LIMIT   = 3,
+    FORWARD_PROBE_MS        = 1000,
+    FORWARD_PROBE_WAIT_MS   = 500,
+    FORWARD_ADDRESS_LIMIT   = 64,
+};
+
+// NOTE(ariel) Threads update the counters of an upstream concurrently, so
+// each upstream takes a cache line of its own.
+typedef struct {
+    _Alignas(64) sockaddr_storage addr;
+    char *text;
+
+    u32 outstanding;
+    u32 failures;
+    u64 srtt;   // NOTE(ariel) Nanoseconds, zero until the first sample.
+} Upstream;
+
+global Upstream g_upstreams[FORWARD_UPSTREAM_LIMIT];
+global u32 g_upstream_count;
+global Forward_Policy g_policy;
+global bool g_probing;
+
+global char *FORWARD_POLICY_STRING[FORWARD_POLICY_COUNT] = {
+    [FORWARD_ROUND_ROBIN]       = "round-robin",
+    [FORWARD_LEAST_OUTSTANDING] = "least-outstanding",
+    [FORWARD_FASTEST]           = "fastest",
+};
+
+global _Thread_local u32 t_rotation;
+
+
+/* ---
+ * Keep the health and latency of each upstream.
+ * ---
+ */
+
+internal inline bool
+upstream_down(Upstream *u)
+{
+    return __atomic_load_n(&u->failures, __ATOMIC_RELAXED) >= FORWARD_FAILURE_LIMIT;
+}
+
+internal void
+update_srtt(Upstream *u, u64 rtt)
+{
+    // NOTE(ariel) Smooth samples as RFC 6298 does, with a gain of 1/8. Two
+    // threads may race to store a sample, and one of them then loses it,
+    // which matters little for an estimate.
+    u64 srtt = __atomic_load_n(&u->srtt, __ATOMIC_RELAXED);
+    srtt = srtt ? srtt - srtt / 8 + rtt / 8 : rtt;
+    __atomic_store_n(&u->srtt, MAX(srtt, 1), __ATOMIC_RELAXED);
+}
+
+void
+forward_success(i32 upstream, u64 rtt)
+{
+    Upstream *u = &g_upstreams[upstream];
+    update_srtt(u, rtt);
+    if (__atomic_load_n(&u->failures, __ATOMIC_RELAXED)) {
+        if (__atomic_exchange_n(&u->failures, 0, __ATOMIC_RELAXED) >= FORWARD_FAILURE_LIMIT && g_probing)
+            fprintf(stderr, "upstream %s is up\n", u->text);
+    }
+}
+
+void
+forward_failure(i32 upstream)
+{
+    // NOTE(ariel) A timeout counts as a sample of the retransmission interval,
+    // so the fastest upstream does not stay so once it stops replying.
+    Upstream *u = &g_upstreams[upstream];
+    update_srtt(u, (u64)DNS_RETRANSMIT_MS * 1000000);
+    if (__atomic_add_fetch(&u->failures, 1, __ATOMIC_RELAXED) == FORWARD_FAILURE_LIMIT && g_probing)
+        fprintf(stderr, "upstream %s is down\n", u->text);
+}
+
+
+/* ---
+ * Pick an upstream for each transmission.
+ * ---
+ */
+
+internal bool
+better(Upstream *u, Upstream *best)
+{
+    switch (g_policy) {
+        case FORWARD_LEAST_OUTSTANDING:
+            return __atomic_load_n(&u->outstanding, __ATOMIC_RELAXED) <
+                __atomic_load_n(&best->outstanding, __ATOMIC_RELAXED);
+        case FORWARD_FASTEST:
+            return __atomic_load_n(&u->srtt, __ATOMIC_RELAXED) < __atomic_load_n(&best->srtt, __ATOMIC_RELAXED);
+        default:
+            return false;
+    }
+}
+
+i32
+forward_pick(u32 tried, sockaddr_storage *addr)
+{
+    // NOTE(ariel) Start from a rotating position so the policies that compare
+    // upstreams break ties evenly, and so round-robin only has to take the
+    // first eligible upstream. Prefer upstreams that are up and untried, then
+    // any untried upstream, and then any upstream at all.
+    u32 start = t_rotation++;
+    i32 best = -1;
+    for (u32 pass = 0; pass < 3 && best == -1; ++pass) {
+        for (u32 i = 0; i < g_upstream_count; ++i) {
+            u32 k = (start + i) % g_upstream_count;
+            Upstream *u = &g_upstreams[k];
+            if (pass < 2 && (tried & 1u << k)) continue;
+            if (pass < 1 && upstream_down(u)) continue;
+            if (best == -1 || better(u, &g_upstreams[best])) best = k;
+            if (g_policy == FORWARD_ROUND_ROBIN) break;
+        }
+    }
+    assert(best != -1);
+
+    __atomic_add_fetch(&g_upstreams[best].outstanding, 1, __ATOMIC_RELAXED);
+    *addr = g_upstreams[best].addr;
+    return best;
+}
+
+sockaddr_storage *
+forward_addr(i32 upstream)
+{
+    return &g_upstreams[upstream].addr;
+}
+
+void
+forward_release(i32 upstream)
+{
+    __atomic_sub_fetch(&g_upstreams[upstream].outstanding, 1, __ATOMIC_RELAXED);
+}
+
+
+/* ---
+ * Probe every upstream in the background.
+ * ---
+ */
+
+internal void *
+probe(void *arg)
+{
+    (void)arg;
+
+    // NOTE(ariel) Ask each upstream for the nameservers of the root, which any
+    // working recursive resolver answers at once from its cache.
+    u8 query[] = {
+        0, 0, DNS_HEADER_FLAG_RD >> 8, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+        0, 0, RR_TYPE_NS, 0, RR_CLASS_IN,
+    };
+
+    for (;;) {
+        struct timespec interval = { .tv_nsec = (long)(FORWARD_PROBE_MS - FORWARD_PROBE_WAIT_MS) * 1000000 };
+        nanosleep(&interval, 0);
+
+        // NOTE(ariel) Probes take fresh sockets on ephemeral ports and IDs from
+        // the CSPRNG, so a forged reply cannot keep a dead upstream up.
+        struct pollfd fds[FORWARD_UPSTREAM_LIMIT] = {0};
+        u16 ids[FORWARD_UPSTREAM_LIMIT] = {0};
+        if (getrandom(ids, sizeof(ids), 0) != sizeof(ids)) continue;
+        u64 sent = stats_now();
+
+        for (u32 i = 0; i < g_upstream_count; ++i) {
+            Upstream *u = &g_upstreams[i];
+            socklen_t socklen = u->addr.ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+            query[0] = ids[i] >> 8;
+            query[1] = ids[i];
+
+            // NOTE(ariel) A connected socket only receives from its upstream.
+            fds[i].events = POLLIN;
+            fds[i].fd = socket(u->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fds[i].fd == -1) continue;
+            if (connect(fds[i].fd, (sockaddr *)&u->addr, socklen) == -1 || send(fds[i].fd, query, sizeof(query), 0) == -1) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+            }
+        }
+
+        u32 waiting = g_upstream_count;
+        bool replied[FORWARD_UPSTREAM_LIMIT] = {0};
+        for (i64 left = FORWARD_PROBE_WAIT_MS; waiting && left > 0;) {
+            if (poll(fds, g_upstream_count, left) <= 0) break;
+            for (u32 i = 0; i < g_upstream_count; ++i) {
+                if (!(fds[i].revents & POLLIN)) continue;
+
+                u8 reply[UDP_MSG_LIMIT];
+                ssize_t len = recv(fds[i].fd, reply, sizeof(reply), 0);
+                if (len < DNS_HEADER_LIMIT || (reply[0] << 8 | reply[1]) != ids[i] || !(reply[2] & 0x80)) continue;
+
+                // NOTE(ariel) An upstream that refuses the query or fails at
+                // it counts as down all the same.
+                u8 rcode = reply[3] & DNS_HEADER_MASK_R;
+                if (rcode != DNS_RCODE_SERVFAIL && rcode != DNS_RCODE_REFUSED) {
+                    replied[i] = true;
+                    forward_success(i, stats_now() - sent);
+                }
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                --waiting;
+            }
+            left = FORWARD_PROBE_WAIT_MS - (i64)(stats_now() - sent) / 1000000;
+        }
+
+        for (u32 i = 0; i < g_upstream_count; ++i) {
+            if (fds[i].fd != -1) close(fds[i].fd);
+            if (!replied[i]) forward_failure(i);
+        }
+    }
+
+    return 0;
+}
+
+
+/* ---
+ * Configure the pool.
+ * ---
+ */
+
+internal void
+parse_upstream(char *text, sockaddr_storage *addr)
+{
+    char host[FORWARD_ADDRESS_LIMIT] = {0};
+    char *port = strchr(text, '#');
+    size_t len = port ? (size_t)(port - text) : strlen(text);
+    if (len >= sizeof(host)) err_exit("invalid address of upstream %s", text);
+    memcpy(host, text, len);
+
+    u16 number = 53;
+    if (port) {
+        char *end = 0;
+        unsigned long value = strtoul(port + 1, &end, 10);
+        if (!port[1] || *end || !value || value > UINT16_MAX) err_exit("invalid port of upstream %s", text);
+        number = value;
+    }
+
+    *addr = (sockaddr_storage){0};
+    sockaddr_in *sa = (sockaddr_in *)addr;
+    sockaddr_in6 *sa6 = (sockaddr_in6 *)addr;
+    if (inet_pton(AF_INET, host, &sa->sin_addr) == 1) {
+        sa->sin_family = AF_INET;
+        sa->sin_port = htons(number);
+    } else if (inet_pton(AF_INET6, host, &sa6->sin6_addr) == 1) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(number);
+    } else {
+        err_exit("invalid address of upstream %s", text);
+    }
+}
+
+Forward_Policy
+forward_policy_from_string(char *s)
+{
+    for (Forward_Policy policy = 0; policy < FORWARD_POLICY_COUNT; ++policy) {
+        if (!strcmp(s, FORWARD_POLICY_STRING[policy])) return policy;
+    }
+    return FORWARD_POLICY_COUNT;
+}
+
+bool
+forward_enabled(void)
+{
+    return g_upstream_count;
+}
+
+void
+forward_configure(char **upstreams, u32 count, Forward_Policy policy)
+{
+    errno = 0;
+    assert(count <= FORWARD_UPSTREAM_LIMIT);
+    if (policy >= FORWARD_POLICY_COUNT) err_exit("unsupported policy of forwarding");
+
+    for (u32 i = 0; i < count; ++i) {
+        g_upstreams[i] = (Upstream){ .text = upstreams[i] };
+        parse_upstream(upstreams[i], &g_upstreams[i].addr);
+    }
+    g_upstream_count = count;
+    g_policy = policy;
+    t_rotation = 0;
+}
+
+void
+forward_init(char **upstreams, u32 count, Forward_Policy policy)
+{
+    forward_configure(upstreams, count, policy);
+    g_probing = true;
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, probe, 0)) err_exit("failed to start thread to probe upstreams");
+    pthread_detach(thread);
+}
@@ -0,0 +1,708 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "epoch.h"
+#include "err_exit.h"
+#include "hosts.h"
+#include "intern.h"
+#include "str.h"
+
+enum {
+    HOSTS_TTL = 3600,
+    HOSTS_TOKEN_LIMIT = 64,
+    HOSTS_ERROR_LIMIT = 256,
+
+    // NOTE(ariel) Keys per bucket on average, and how hard to search for a
+    // displacement before the build starts over with another seed.
+    HOSTS_BUCKET_SIZE = 2,
+    HOSTS_DISPLACEMENT_LIMIT = 1 << 20,
+    HOSTS_SEED_LIMIT = 32,
+};
+
+// NOTE(ariel) The records of one type of a name in wire form.
+typedef struct {
+    u8 *records;
+    u32 len;
+    u16 type;
+    u16 count;
+} Hosts_Records;
+
+// NOTE(ariel) A name along with the records of every type it has.
+typedef struct {
+    u64 name_hash;
+    u8 *name;
+    Hosts_Records *types;
+    u16 name_len;
+    u16 type_count;
+} Hosts_Entry;
+
+typedef struct {
+    Arena arena;
+    u64 seed;
+    u32 count;
+    u32 bucket_count;
+    u32 *displacement;
+    Hosts_Entry *entry;
+} Hosts_Table;
+
+// NOTE(ariel) A record in wire form along with its key while the table is
+// under construction. Names live in a table of names private to the build.
+typedef struct {
+    Name_ID name;
+    u16 type;
+    u8 *wire;
+    u32 len;
+} Override;
+
+typedef struct {
+    Intern_Table names;
+    Arena records;
+    Arena overrides;
+    Arena scratch;
+    Override *override;
+    u32 count;
+
+    char *path;
+    u32 line;
+    char error[HOSTS_ERROR_LIMIT];
+} Hosts_Builder;
+
+global Hosts_Table *g_hosts;
+global Epoch g_hosts_epoch;
+global char **g_hosts_paths;
+global u32 g_hosts_path_count;
+
+
+/* ---
+ * Hash keys onto slots.
+ * ---
+ */
+
+internal inline u64
+mix(u64 x)
+{
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+internal inline u64
+key_hash(Hosts_Table *t, u64 name_hash)
+{
+    return mix(name_hash ^ t->seed);
+}
+
+internal inline u32
+bucket_of(Hosts_Table *t, u64 h)
+{
+    return (h >> 32) % t->bucket_count;
+}
+
+// NOTE(ariel) Displacement `d` stands for the pair (d / m, d % m), which
+// moves every key of a bucket along its own arithmetic progression.
+internal inline u32
+slot_of(Hosts_Table *t, u64 h, u32 d)
+{
+    u64 m = t->count;
+    u64 f1 = (u32)h % m;
+    u64 f2 = (u32)mix(h) % m;
+    return (f1 + (d / m) * f2 + d % m) % m;
+}
+
+internal Hosts_Entry *
+find(Hosts_Table *t, u64 name_hash, String wire)
+{
+    u64 h = key_hash(t, name_hash);
+    Hosts_Entry *e = &t->entry[slot_of(t, h, t->displacement[bucket_of(t, h)])];
+    if (e->name_hash != name_hash || e->name_len != wire.len) return 0;
+    return memcmp(e->name, wire.str, wire.len) ? 0 : e;
+}
+
+
+/* ---
+ * Parse the files into records in wire form.
+ * ---
+ */
+
+internal bool
+fail(Hosts_Builder *b, char *reason)
+{
+    snprintf(b->error, sizeof(b->error), "%.160s:%u: %s", b->path, b->line, reason);
+    return false;
+}
+
+internal Name_ID
+name_from_text(Hosts_Builder *b, String text)
+{
+    return intern_text(&b->names, text);
+}
+
+internal bool
+add_record(Hosts_Builder *b, Name_ID name, u16 type, u32 ttl, u8 *rdata, u16 rdlength)
+{
+    String owner = intern_lookup_wire(&b->names, name);
+    u32 len = owner.len + 10 + rdlength;
+    u8 *wire = arena_alloc(&b->records, len);
+
+    u8 *cur = wire;
+    memcpy(cur, owner.str, owner.len);
+    cur += owner.len;
+    *cur++ = type >> 8; *cur++ = type;
+    *cur++ = 0; *cur++ = RR_CLASS_IN;
+    *cur++ = ttl >> 24; *cur++ = ttl >> 16; *cur++ = ttl >> 8; *cur++ = ttl;
+    *cur++ = rdlength >> 8; *cur++ = rdlength;
+    memcpy(cur, rdata, rdlength);
+
+    b->override = arena_realloc(&b->overrides, (b->count + 1) * sizeof(Override));
+    b->override[b->count++] = (Override){
+        .name = name,
+        .type = type,
+        .wire = wire,
+        .len = len,
+    };
+    return true;
+}
+
+internal bool
+add_name(Hosts_Builder *b, u8 *rdata, u16 *rdlength, String text)
+{
+    Name_ID name = name_from_text(b, text);
+    if (!name) return fail(b, "invalid name");
+    String wire = intern_lookup_wire(&b->names, name);
+    memcpy(rdata + *rdlength, wire.str, wire.len);
+    *rdlength += wire.len;
+    return true;
+}
+
+// NOTE(ariel) Map an address back to a name under in-addr.arpa or ip6.arpa.
+internal bool
+add_reverse(Hosts_Builder *b, int family, u8 *addr, String text)
+{
+    char reverse[DNS_DOMAIN_LIMIT] = {0};
+    int len = 0;
+    if (family == AF_INET) {
+        len = snprintf(reverse, sizeof(reverse), "%u.%u.%u.%u.in-addr.arpa", addr[3], addr[2], addr[1], addr[0]);
+    } else {
+        for (i32 i = 15; i >= 0; --i) {
+            len += snprintf(reverse + len, sizeof(reverse) - len, "%x.%x.", addr[i] & 0xf, addr[i] >> 4);
+        }
+        len += snprintf(reverse + len, sizeof(reverse) - len, "ip6.arpa");
+    }
+
+    u8 rdata[DNS_DOMAIN_LIMIT] = {0};
+    u16 rdlength = 0;
+    Name_ID name = name_from_text(b, (String){ .str = (u8 *)reverse, .len = len });
+    return add_name(b, rdata, &rdlength, text) && add_record(b, name, RR_TYPE_PTR, HOSTS_TTL, rdata, rdlength);
+}
+
+internal bool
+parse_number(String token, u32 limit, u32 *value)
+{
+    if (!token.len || token.len > 10) return false;
+    u64 n = 0;
+    for (size_t i = 0; i < token.len; ++i) {
+        if (token.str[i] < '0' || token.str[i] > '9') return false;
+        n = 10 * n + (token.str[i] - '0');
+    }
+    if (n > limit) return false;
+    *value = n;
+    return true;
+}
+
+internal bool
+parse_address(String token, int family, u8 *addr)
+{
+    char text[64] = {0};
+    if (token.len >= sizeof(text)) return false;
+    memcpy(text, token.str, token.len);
+    return inet_pton(family, text, addr) == 1;
+}
+
+internal bool
+parse_hosts_line(Hosts_Builder *b, String *tokens, u32 count, int family, u8 *addr)
+{
+    if (count < 2) return fail(b, "address without any name");
+
+    u16 type = family == AF_INET ? RR_TYPE_A : RR_TYPE_AAAA;
+    u16 rdlength = family == AF_INET ? 4 : 16;
+    for (u32 i = 1; i < count; ++i) {
+        Name_ID name = name_from_text(b, tokens[i]);
+        if (!name) return fail(b, "invalid name");
+        add_record(b, name, type, HOSTS_TTL, addr, rdlength);
+    }
+    return add_reverse(b, family, addr, tokens[1]);
+}
+
+internal bool
+parse_zone_line(Hosts_Builder *b, String *tokens, u32 count)
+{
+    Name_ID name = name_from_text(b, tokens[0]);
+    if (!name) return fail(b, "invalid name");
+
+    u32 i = 1;
+    u32 ttl = HOSTS_TTL;
+    if (i < count && parse_number(tokens[i], TTL_LIMIT, &ttl)) ++i;
+    if (i < count && string_cmp_nocase(tokens[i], (String){ .str = (u8 *)"IN", .len = 2 })) ++i;
+    if (i == count) return fail(b, "record without type");
+
+    u16 type = rr_type_from_string(tokens[i++]);
+    String *rdata = &tokens[i];
+    u32 rdata_count = count - i;
+
+    u8 buf[UINT16_MAX] = {0};
+    u16 len = 0;
+    u32 n[3] = {0};
+    switch (type) {
+        case RR_TYPE_A:
+        case RR_TYPE_AAAA: {
+            int family = type == RR_TYPE_A ? AF_INET : AF_INET6;
+            if (rdata_count != 1 || !parse_address(rdata[0], family, buf)) return fail(b, "invalid address");
+            len = type == RR_TYPE_A ? 4 : 16;
+            break;
+        }
+        case RR_TYPE_NS:
+        case RR_TYPE_CNAME:
+        case RR_TYPE_PTR: {
+            if (rdata_count != 1) return fail(b, "expected one name");
+            if (!add_name(b, buf, &len, rdata[0])) return false;
+            break;
+        }
+        case RR_TYPE_MX: {
+            if (rdata_count != 2 || !parse_number(rdata[0], UINT16_MAX, &n[0])) return fail(b, "invalid MX record");
+            buf[len++] = n[0] >> 8; buf[len++] = n[0];
+            if (!add_name(b, buf, &len, rdata[1])) return false;
+            break;
+        }
+        case RR_TYPE_SRV: {
+            if (rdata_count != 4) return fail(b, "invalid SRV record");
+            for (u32 j = 0; j < 3; ++j) {
+                if (!parse_number(rdata[j], UINT16_MAX, &n[j])) return fail(b, "invalid SRV record");
+                buf[len++] = n[j] >> 8; buf[len++] = n[j];
+            }
+            if (!add_name(b, buf, &len, rdata[3])) return false;
+            break;
+        }
+        case RR_TYPE_TXT: {
+            if (!rdata_count) return fail(b, "TXT record without text");
+            for (u32 j = 0; j < rdata_count; ++j) {
+                String s = rdata[j];
+                if (s.str[0] == '"') {
+                    if (s.len < 2 || s.str[s.len - 1] != '"') return fail(b, "unterminated quote");
+                    s = (String){ .str = s.str + 1, .len = s.len - 2 };
+                }
+                if (s.len > 255) return fail(b, "text longer than 255 bytes");
+                buf[len++] = s.len;
+                memcpy(buf + len, s.str, s.len);
+                len += s.len;
+            }
+            break;
+        }
+        default: return fail(b, "unsupported type of record");
+    }
+
+    return add_record(b, name, type, ttl, buf, len);
+}
+
+// NOTE(ariel) Return one more than `HOSTS_TOKEN_LIMIT` if the line holds more
+// tokens than that.
+internal u32
+split_line(char *line, size_t n, String *tokens)
+{
+    u32 count = 0;
+    u8 *cur = (u8 *)line;
+    u8 *end = cur + n;
+
+    while (cur < end) {
+        if (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n') {
+            ++cur;
+        } else if (*cur == '#' || *cur == ';') {
+            break;
+        } else {
+            u8 *start = cur;
+            if (*cur == '"') {
+                for (++cur; cur < end && *cur != '"'; ++cur);
+                if (cur < end) ++cur;
+            } else {
+                // NOTE(ariel) Bound the set of separators by its length, so
+                // a NUL byte, which `strchr()` would match as the end of the
+                // set, stays part of a token.
+                while (cur < end && !memchr(" \t\r\n#;", *cur, 6)) ++cur;
+            }
+            if (count == HOSTS_TOKEN_LIMIT) return count + 1;
+            tokens[count++] = (String){ .str = start, .len = cur - start };
+        }
+    }
+
+    return count;
+}
+
+internal bool
+parse_file(Hosts_Builder *b, char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        snprintf(b->error, sizeof(b->error), "failed to open %.160s (%s)", path, strerror(errno));
+        return false;
+    }
+    b->path = path;
+    b->line = 0;
+
+    bool ok = true;
+    char *line = 0;
+    size_t cap = 0;
+    ssize_t n = 0;
+    while (ok && (n = getline(&line, &cap, file)) != -1) {
+        ++b->line;
+        String tokens[HOSTS_TOKEN_LIMIT] = {0};
+        u32 count = split_line(line, n, tokens);
+        if (!count) continue;
+        if (count > HOSTS_TOKEN_LIMIT) {
+            ok = fail(b, "too many fields");
+            break;
+        }
+
+        u8 addr[16] = {0};
+        if (parse_address(tokens[0], AF_INET, addr)) {
+            ok = parse_hosts_line(b, tokens, count, AF_INET, addr);
+        } else if (parse_address(tokens[0], AF_INET6, addr)) {
+            ok = parse_hosts_line(b, tokens, count, AF_INET6, addr);
+        } else {
+            ok = parse_zone_line(b, tokens, count);
+        }
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+
+/* ---
+ * Build the table.
+ * ---
+ */
+
+internal int
+compare_overrides(const void *a, const void *b)
+{
+    const Override *x = a;
+    const Override *y = b;
+    if (x->name != y->name) return x->name < y->name ? -1 : 1;
+    if (x->type != y->type) return x->type < y->type ? -1 : 1;
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    return memcmp(x->wire, y->wire, x->len);
+}
+
+internal bool
+same_key(Override *a, Override *b)
+{
+    return a->name == b->name && a->type == b->type;
+}
+
+// NOTE(ariel) Copy the records of every name into an entry of its own, with
+// those of each type grouped together.
+internal u32
+collect_entries(Hosts_Builder *b, Hosts_Table *t, Hosts_Entry *entries)
+{
+    qsort(b->override, b->count, sizeof(Override), compare_overrides);
+
+    u32 count = 0;
+    for (u32 i = 0; i < b->count;) {
+        Override *o = &b->override[i];
+        String wire = intern_lookup_wire(&b->names, o->name);
+
+        u32 end = i;
+        u16 type_count = 0;
+        for (; end < b->count && b->override[end].name == o->name; ++end) {
+            if (end == i || !same_key(&b->override[end], &b->override[end - 1])) ++type_count;
+        }
+
+        Hosts_Entry *entry = &entries[count++];
+        *entry = (Hosts_Entry){
+            .name_hash = intern_lookup_hash(&b->names, o->name),
+            .name = arena_alloc(&t->arena, wire.len),
+            .types = arena_alloc(&t->arena, type_count * sizeof(Hosts_Records)),
+            .name_len = wire.len,
+        };
+        memcpy(entry->name, wire.str, wire.len);
+
+        for (u32 j = i; j < end;) {
+            u32 k = j;
+            u32 len = 0;
+            for (; k < end && same_key(&b->override[k], &b->override[j]); ++k) len += b->override[k].len;
+
+            Hosts_Records *records = &entry->types[entry->type_count++];
+            *records = (Hosts_Records){ .type = b->override[j].type, .records = arena_alloc(&t->arena, len) };
+            for (u32 l = j; l < k; ++l) {
+                // NOTE(ariel) Drop records that repeat, e.g. a name listed
+                // twice for the same address.
+                Override *r = &b->override[l];
+                if (l > j && !compare_overrides(r, &b->override[l - 1])) continue;
+                memcpy(records->records + records->len, r->wire, r->len);
+                records->len += r->len;
+                ++records->count;
+            }
+            j = k;
+        }
+        i = end;
+    }
+
+    return count;
+}
+
+internal bool
+place_entries(Hosts_Builder *b, Hosts_Table *t, Hosts_Entry *entries)
+{
+    u32 m = t->count;
+    u32 r = t->bucket_count;
+
+    // NOTE(ariel) Order keys by bucket, and buckets by size from largest to
+    // smallest, since large buckets only fit while the table is still empty.
+    u64 *hashes = arena_alloc(&b->scratch, m * sizeof(u64));
+    u32 *sizes = arena_alloc(&b->scratch, r * sizeof(u32));
+    u32 *starts = arena_alloc(&b->scratch, (r + 1) * sizeof(u32));
+    u32 *keys = arena_alloc(&b->scratch, m * sizeof(u32));
+    u32 *order = arena_alloc(&b->scratch, r * sizeof(u32));
+    u8 *taken = arena_alloc(&b->scratch, m);
+    u32 *slots = arena_alloc(&b->scratch, m * sizeof(u32));
+
+    for (u32 i = 0; i < m; ++i) {
+        hashes[i] = key_hash(t, entries[i].name_hash);
+        ++sizes[bucket_of(t, hashes[i])];
+    }
+    for (u32 i = 0; i < r; ++i) starts[i + 1] = starts[i] + sizes[i];
+    for (u32 i = 0; i < m; ++i) {
+        u32 bucket = bucket_of(t, hashes[i]);
+        keys[starts[bucket] + --sizes[bucket]] = i;
+    }
+    for (u32 i = 0; i < r; ++i) sizes[i] = starts[i + 1] - starts[i];
+
+    // NOTE(ariel) Counting sort of buckets by size.
+    u32 largest = 0;
+    for (u32 i = 0; i < r; ++i) largest = MAX(largest, sizes[i]);
+    u32 n = 0;
+    for (u32 size = largest; size > 0; --size) {
+        for (u32 i = 0; i < r; ++i) {
+            if (sizes[i] == size) order[n++] = i;
+        }
+    }
+
+    u32 free_slot = 0;
+    for (u32 i = 0; i < n; ++i) {
+        u32 bucket = order[i];
+        u32 *members = &keys[starts[bucket]];
+        u32 size = sizes[bucket];
+
+        // NOTE(ariel) Buckets of a single key come last, when free slots grow
+        // scarce. A displacement below m shifts the key to any slot at all,
+        // so move it straight to the next free one rather than search.
+        if (size == 1) {
+            while (taken[free_slot]) ++free_slot;
+            u32 f1 = slot_of(t, hashes[members[0]], 0);
+            t->displacement[bucket] = (free_slot + m - f1) % m;
+            taken[free_slot] = 1;
+            t->entry[free_slot] = entries[members[0]];
+            continue;
+        }
+
+        bool placed = false;
+        for (u32 d = 0; d < HOSTS_DISPLACEMENT_LIMIT && !placed; ++d) {
+            placed = true;
+            for (u32 k = 0; k < size && placed; ++k) {
+                slots[k] = slot_of(t, hashes[members[k]], d);
+                if (taken[slots[k]]) placed = false;
+                for (u32 l = 0; l < k && placed; ++l) {
+                    if (slots[l] == slots[k]) placed = false;
+                }
+            }
+            if (placed) {
+                t->displacement[bucket] = d;
+                for (u32 k = 0; k < size; ++k) {
+                    taken[slots[k]] = 1;
+                    t->entry[slots[k]] = entries[members[k]];
+                }
+            }
+        }
+        if (!placed) return false;
+    }
+
+    return true;
+}
+
+internal void
+release_table(Hosts_Table *t)
+{
+    arena_release(&t->arena);
+    free(t);
+}
+
+internal Hosts_Table *
+build_table(char **paths, u32 count, char *error, size_t cap)
+{
+    Hosts_Builder b = {0};
+    intern_init(&b.names);
+    arena_init(&b.records);
+    arena_init(&b.overrides);
+    arena_init(&b.scratch);
+    b.override = arena_alloc(&b.overrides, 0);
+
+    Hosts_Table *t = calloc(1, sizeof(Hosts_Table));
+    if (!t) {
+        snprintf(b.error, sizeof(b.error), "failed to allocate table of overrides");
+        goto done;
+    }
+    arena_init(&t->arena);
+
+    bool ok = true;
+    for (u32 i = 0; i < count && ok; ++i) ok = parse_file(&b, paths[i]);
+    if (!ok) goto done;
+
+    Hosts_Entry *entries = arena_alloc(&b.scratch, b.count * sizeof(Hosts_Entry));
+    t->count = collect_entries(&b, t, entries);
+    t->bucket_count = MAX((t->count + HOSTS_BUCKET_SIZE - 1) / HOSTS_BUCKET_SIZE, 1);
+    t->displacement = arena_alloc(&t->arena, t->bucket_count * sizeof(u32));
+    t->entry = arena_alloc(&t->arena, t->count * sizeof(Hosts_Entry));
+    if (!t->count) goto done;
+
+    ok = false;
+    for (u32 attempt = 0; attempt < HOSTS_SEED_LIMIT && !ok; ++attempt) {
+        Arena_Checkpoint cp = arena_checkpoint_set(&b.scratch);
+        t->seed = mix(attempt + 1);
+        memset(t->displacement, 0, t->bucket_count * sizeof(u32));
+        ok = place_entries(&b, t, entries);
+        arena_checkpoint_restore(cp);
+    }
+    if (!ok) snprintf(b.error, sizeof(b.error), "failed to find a perfect hash for %u keys", t->count);
+
+done:
+    arena_release(&b.scratch);
+    arena_release(&b.overrides);
+    arena_release(&b.records);
+    intern_release(&b.names);
+
+    if (b.error[0]) {
+        snprintf(error, cap, "%s", b.error);
+        if (t) release_table(t);
+        return 0;
+    }
+    return t;
+}
+
+
+/* ---
+ * Answer queries and reload on SIGHUP.
+ * ---
+ */
+
+internal void *
+reload(void *arg)
+{
+    (void)arg;
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    for (;;) {
+        int sig = 0;
+        if (sigwait(&set, &sig)) continue;
+
+        char error[HOSTS_ERROR_LIMIT] = {0};
+        Hosts_Table *t = build_table(g_hosts_paths, g_hosts_path_count, error, sizeof(error));
+        if (!t) {
+            fprintf(stderr, "error: %s, keeping previous overrides\n", error);
+            continue;
+        }
+
+        // NOTE(ariel) Free the replaced table once no lookup can still read
+        // it.
+        Hosts_Table *current = __atomic_exchange_n(&g_hosts, t, __ATOMIC_SEQ_CST);
+        epoch_wait(&g_hosts_epoch);
+        release_table(current);
+    }
+
+    return 0;
+}
+
+void
+hosts_init(char **paths, u32 count)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &set, 0)) err_exit("failed to block SIGHUP");
+
+    g_hosts_paths = paths;
+    g_hosts_path_count = count;
+
+    char error[HOSTS_ERROR_LIMIT] = {0};
+    Hosts_Table *t = build_table(paths, count, error, sizeof(error));
+    if (!t) {
+        errno = 0;
+        err_exit("%s", error);
+    }
+    __atomic_store_n(&g_hosts, t, __ATOMIC_RELEASE);
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, reload, 0)) err_exit("failed to start thread to reload overrides");
+    pthread_detach(thread);
+}
+
+internal bool
+lookup(Hosts_Table *t, Name_ID name, u16 qtype, Resolution *resolution)
+{
+    if (!t->count) return false;
+
+    u64 name_hash = intern_lookup_hash(&g_names, name);
+    String wire = intern_lookup_wire(&g_names, name);
+    Hosts_Entry *e = find(t, name_hash, wire);
+    if (!e) return false;
+
+    // NOTE(ariel) Answer with the alias of a name that has no records of the
+    // type asked for, as its zone would.
+    Hosts_Records *records = 0;
+    for (u16 i = 0; i < e->type_count; ++i) {
+        Hosts_Records *r = &e->types[i];
+        if (r->type == qtype) {
+            records = r;
+            break;
+        }
+        if (r->type == RR_TYPE_CNAME) records = r;
+    }
+
+    *resolution = (Resolution){ .rcode = DNS_RCODE_NOERROR };
+    if (records) {
+        // NOTE(ariel) Names in rdata decode into the names of the calling
+        // thread, so they cannot be resolved when the table is built. Records
+        // of raw rdata point into the buffer they parse from, so only those
+        // are copied out of the table, which a reload may free.
+        String buf = { .str = records->records, .len = records->len };
+        if (rr_rdata_is_raw(records->type)) {
+            buf.str = arena_alloc(&g_arena, buf.len);
+            memcpy(buf.str, records->records, buf.len);
+        }
+        parse_records(&resolution->answer, records->count, buf);
+    }
+    return true;
+}
+
+bool
+hosts_lookup(Name_ID name, u16 qtype, Resolution *resolution)
+{
+    if (!__atomic_load_n(&g_hosts, __ATOMIC_RELAXED)) return false;
+
+    u32 parity = epoch_enter(&g_hosts_epoch);
+    Hosts_Table *t = __atomic_load_n(&g_hosts, __ATOMIC_ACQUIRE);
+    bool found = lookup(t, name, qtype, resolution);
+    epoch_exit(&g_hosts_epoch, parity);
+    return found;
+}
@@ -0,0 +1,184 @@
+#include <string.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "intern.h"
+#include "str.h"
+
+enum { INTERN_INITIAL_SLOTS = 1024 };
+
+_Thread_local Intern_Table g_names = {0};
+
+internal void
+rebuild_table(Intern_Table *t, u32 slot_count)
+{
+    // NOTE(ariel) The arena for slots only ever holds the current table, so
+    // clear it and rehash every name from the stored hashes.
+    arena_clear(&t->slots);
+    t->table = arena_alloc(&t->slots, slot_count * sizeof(u32));
+    t->mask = slot_count - 1;
+
+    for (u32 id = 1; id <= t->count; ++id) {
+        u32 i = t->names[id].hash & t->mask;
+        while (t->table[i]) i = (i + 1) & t->mask;
+        t->table[i] = id;
+    }
+}
+
+void
+intern_init(Intern_Table *t)
+{
+    arena_init(&t->strings);
+    arena_init(&t->entries);
+    arena_init(&t->slots);
+
+    // NOTE(ariel) The array of entries is the only allocation on its arena,
+    // so it grows in place and never moves. Its first entry remains unused
+    // to reserve the ID `NAME_ID_NONE`.
+    t->names = arena_alloc(&t->entries, sizeof(Interned_Name));
+    t->count = 0;
+
+    rebuild_table(t, INTERN_INITIAL_SLOTS);
+}
+
+void
+intern_release(Intern_Table *t)
+{
+    arena_release(&t->strings);
+    arena_release(&t->entries);
+    arena_release(&t->slots);
+    *t = (Intern_Table){0};
+}
+
+internal Name_ID
+intern(Intern_Table *t, String wire, bool insert)
+{
+    u8 canon[DNS_DOMAIN_LIMIT] = {0};
+    u8 text[DNS_DOMAIN_LIMIT] = {0};
+    size_t text_len = 0;
+
+
+    /* ---
+     * Validate the name and convert it to canonical form.
+     * ---
+     */
+    {
+        if (!wire.len || wire.len >= DNS_DOMAIN_LIMIT) return NAME_ID_NONE;
+
+        size_t i = 0;
+        for (;;) {
+            u8 len = wire.str[i];
+            if (len >= LABEL_SIZE_LIMIT || i + 1 + len > wire.len) return NAME_ID_NONE;
+
+            canon[i] = len;
+            if (!len) break;
+
+            if (text_len) text[text_len++] = '.';
+            for (u8 j = 1; j <= len; ++j) {
+                u8 c = wire.str[i + j];
+                c = c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+                canon[i + j] = text[text_len++] = c;
+            }
+            i += 1 + len;
+        }
+
+        if (i + 1 != wire.len) return NAME_ID_NONE;
+    }
+
+
+    /* ---
+     * Find an existing entry for the name.
+     * ---
+     */
+    String key = { .str = canon, .len = wire.len };
+    u64 hash = string_hash(key);
+    u32 slot = hash & t->mask;
+    while (t->table[slot]) {
+        Interned_Name *name = &t->names[t->table[slot]];
+        if (name->hash == hash && string_cmp(name->wire, key)) return t->table[slot];
+        slot = (slot + 1) & t->mask;
+    }
+    if (!insert) return NAME_ID_NONE;
+
+
+    /* ---
+     * Otherwise insert a copy of it.
+     * ---
+     */
+    Name_ID id = ++t->count;
+    t->names = arena_realloc(&t->entries, (id + 1) * sizeof(Interned_Name));
+
+    Interned_Name *name = &t->names[id];
+    name->hash = hash;
+    name->wire.len = key.len;
+    name->wire.str = arena_alloc(&t->strings, key.len);
+    memcpy(name->wire.str, key.str, key.len);
+    name->text.len = text_len;
+    name->text.str = arena_alloc(&t->strings, text_len);
+    memcpy(name->text.str, text, text_len);
+
+    t->table[slot] = id;
+    if (2 * t->count > t->mask) rebuild_table(t, 2 * (t->mask + 1));
+
+    return id;
+}
+
+Name_ID
+intern_wire(Intern_Table *t, String wire)
+{
+    return intern(t, wire, true);
+}
+
+Name_ID
+intern_find_wire(Intern_Table *t, String wire)
+{
+    return intern(t, wire, false);
+}
+
+Name_ID
+intern_text(Intern_Table *t, String text)
+{
+    u8 wire[DNS_DOMAIN_LIMIT] = {0};
+    size_t len = 0;
+
+    for (size_t start = 0; start < text.len;) {
+        size_t end = string_find(text, '.', start);
+        size_t label = end - start;
+        if (label >= LABEL_SIZE_LIMIT || len + 1 + label >= DNS_DOMAIN_LIMIT - 1) return NAME_ID_NONE;
+
+        // NOTE(ariel) Tolerate a trailing dot, i.e. an explicit root label,
+        // but no other empty label.
+        if (!label && end != text.len - 1) return NAME_ID_NONE;
+        if (label) {
+            wire[len++] = label;
+            memcpy(wire + len, text.str + start, label);
+            len += label;
+        }
+        start = end + 1;
+    }
+    wire[len++] = 0;
+
+    return intern_wire(t, (String){ .str = wire, .len = len });
+}
+
+String
+intern_lookup_wire(Intern_Table *t, Name_ID id)
+{
+    assert(id && id <= t->count);
+    return t->names[id].wire;
+}
+
+String
+intern_lookup_text(Intern_Table *t, Name_ID id)
+{
+    assert(id && id <= t->count);
+    return t->names[id].text;
+}
+
+u64
+intern_lookup_hash(Intern_Table *t, Name_ID id)
+{
+    assert(id && id <= t->count);
+    return t->names[id].hash;
+}
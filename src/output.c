@@ -0,0 +1,431 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "output.h"
+#include "str.h"
+
+global char *OUTPUT_FORMAT_STRING[OUTPUT_FORMAT_COUNT] = {
+    [OUTPUT_JSONL]  = "jsonl",
+    [OUTPUT_CSV]    = "csv",
+    [OUTPUT_BINARY] = "binary",
+};
+
+// NOTE(ariel) Statuses in a form that scripts match on, unlike the messages of
+// `DNS_STATUS_STRING`.
+global char *OUTPUT_STATUS_STRING[DNS_STATUS_COUNT] = {
+    [DNS_OK]                = "ok",
+    [DNS_ERR_INVALID_NAME]  = "invalid-name",
+    [DNS_ERR_NETWORK]       = "network",
+    [DNS_ERR_TIMEOUT]       = "timeout",
+    [DNS_ERR_MALFORMED]     = "malformed",
+    [DNS_ERR_NO_NAMESERVER] = "no-nameserver",
+    [DNS_ERR_HOP_LIMIT]     = "hop-limit",
+    [DNS_ERR_BUSY]          = "busy",
+};
+
+global char *OUTPUT_RCODE_STRING[] = {
+    [DNS_RCODE_NOERROR]  = "NOERROR",
+    [DNS_RCODE_FORMERR]  = "FORMERR",
+    [DNS_RCODE_SERVFAIL] = "SERVFAIL",
+    [DNS_RCODE_NXDOMAIN] = "NXDOMAIN",
+    [DNS_RCODE_NOTIMP]   = "NOTIMP",
+    [DNS_RCODE_REFUSED]  = "REFUSED",
+};
+
+global char OUTPUT_CSV_HEADER[] = "name,type,status,rcode,owner,rtype,ttl,data\n";
+
+
+/* ---
+ * Append to growable buffers.
+ * ---
+ */
+
+internal void
+reserve(Output_Buffer *b, size_t n)
+{
+    if (b->len + n <= b->cap) return;
+    size_t cap = MAX(b->cap * 2, b->len + n);
+    cap = MAX(cap, KB(4));
+    u8 *buf = realloc(b->buf, cap);
+    if (!buf) err_exit("failed to allocate memory for output");
+    b->buf = buf;
+    b->cap = cap;
+}
+
+internal inline void
+put(Output_Buffer *b, void *data, size_t n)
+{
+    reserve(b, n);
+    memcpy(b->buf + b->len, data, n);
+    b->len += n;
+}
+
+internal inline void
+put_byte(Output_Buffer *b, u8 c)
+{
+    reserve(b, 1);
+    b->buf[b->len++] = c;
+}
+
+internal inline void
+put_cstr(Output_Buffer *b, char *s)
+{
+    put(b, s, strlen(s));
+}
+
+internal void
+put_u64(Output_Buffer *b, u64 n)
+{
+    u8 digits[20];
+    u32 count = 0;
+    do digits[count++] = '0' + n % 10; while (n /= 10);
+    reserve(b, count);
+    while (count) b->buf[b->len++] = digits[--count];
+}
+
+internal void
+put_be(Output_Buffer *b, u64 n, u32 size)
+{
+    reserve(b, size);
+    for (u32 i = size; i > 0; --i) b->buf[b->len++] = n >> 8 * (i - 1);
+}
+
+internal void
+put_type(Output_Buffer *b, u16 type)
+{
+    // NOTE(ariel) Name unknown types as RFC 3597 does.
+    char *name = rr_type_to_string(type);
+    if (strcmp(name, "UNKNOWN")) {
+        put_cstr(b, name);
+    } else {
+        put_cstr(b, "TYPE");
+        put_u64(b, type);
+    }
+}
+
+internal void
+put_json(Output_Buffer *b, String s)
+{
+    // NOTE(ariel) Names and text may hold any byte, not only UTF-8, so escape
+    // every byte outside of printable ASCII.
+    char hex[] = "0123456789abcdef";
+    put_byte(b, '"');
+    reserve(b, 6 * s.len);
+    for (size_t i = 0; i < s.len; ++i) {
+        u8 c = s.str[i];
+        if (c == '"' || c == '\\') {
+            b->buf[b->len++] = '\\';
+            b->buf[b->len++] = c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            memcpy(b->buf + b->len, "\\u00", 4);
+            b->buf[b->len + 4] = hex[c >> 4];
+            b->buf[b->len + 5] = hex[c & 0xf];
+            b->len += 6;
+        } else {
+            b->buf[b->len++] = c;
+        }
+    }
+    put_byte(b, '"');
+}
+
+internal void
+put_csv(Output_Buffer *b, String s)
+{
+    // NOTE(ariel) Quote a field as RFC 4180 requires, doubling any quote.
+    bool quote = false;
+    for (size_t i = 0; i < s.len && !quote; ++i) {
+        u8 c = s.str[i];
+        quote = c == ',' || c == '"' || c == '\n' || c == '\r';
+    }
+    if (!quote) {
+        put(b, s.str, s.len);
+        return;
+    }
+
+    put_byte(b, '"');
+    for (size_t i = 0; i < s.len; ++i) {
+        if (s.str[i] == '"') put_byte(b, '"');
+        put_byte(b, s.str[i]);
+    }
+    put_byte(b, '"');
+}
+
+
+/* ---
+ * Format results.
+ * ---
+ */
+
+internal void
+format_jsonl(Output_Buffer *b, String name, u16 qtype, Resolution *resolution)
+{
+    put_cstr(b, "{\"name\":");
+    put_json(b, name);
+    put_cstr(b, ",\"type\":\"");
+    put_type(b, qtype);
+    put_cstr(b, "\",\"status\":\"");
+    put_cstr(b, OUTPUT_STATUS_STRING[resolution->status]);
+    if (resolution->status) {
+        put_cstr(b, "\",\"rcode\":null");
+    } else {
+        put_cstr(b, "\",\"rcode\":\"");
+        if (resolution->rcode < sizeof(OUTPUT_RCODE_STRING) / sizeof(*OUTPUT_RCODE_STRING)) {
+            put_cstr(b, OUTPUT_RCODE_STRING[resolution->rcode]);
+        } else {
+            put_cstr(b, "RCODE");
+            put_u64(b, resolution->rcode);
+        }
+        put_byte(b, '"');
+    }
+
+    put_cstr(b, ",\"answers\":[");
+    for (u32 i = 0; i < resolution->answer.count; ++i) {
+        Resource_Record *rr = &resolution->answer.rrs[i];
+        if (i) put_byte(b, ',');
+        put_cstr(b, "{\"owner\":");
+        put_json(b, intern_lookup_text(&g_names, rr->owner));
+        put_cstr(b, ",\"type\":\"");
+        put_type(b, rr->type);
+        put_cstr(b, "\",\"ttl\":");
+        put_u64(b, MAX(rr->ttl, 0));
+        put_cstr(b, ",\"data\":");
+        String rdata = {0};
+        (void)format_rdata(&rdata, rr);
+        put_json(b, rdata);
+        put_byte(b, '}');
+    }
+    put_cstr(b, "]}\n");
+}
+
+internal void
+format_csv(Output_Buffer *b, String name, u16 qtype, Resolution *resolution)
+{
+    // NOTE(ariel) Every row repeats the fields of the resolution, so the
+    // prefix is formatted once and copied.
+    size_t start = b->len;
+    put_csv(b, name);
+    put_byte(b, ',');
+    put_type(b, qtype);
+    put_byte(b, ',');
+    put_cstr(b, OUTPUT_STATUS_STRING[resolution->status]);
+    put_byte(b, ',');
+    if (!resolution->status) {
+        if (resolution->rcode < sizeof(OUTPUT_RCODE_STRING) / sizeof(*OUTPUT_RCODE_STRING)) {
+            put_cstr(b, OUTPUT_RCODE_STRING[resolution->rcode]);
+        } else {
+            put_cstr(b, "RCODE");
+            put_u64(b, resolution->rcode);
+        }
+    }
+    put_byte(b, ',');
+    size_t prefix = b->len - start;
+
+    if (!resolution->answer.count) {
+        put_cstr(b, ",,,\n");
+        return;
+    }
+
+    for (u32 i = 0; i < resolution->answer.count; ++i) {
+        Resource_Record *rr = &resolution->answer.rrs[i];
+        if (i) {
+            reserve(b, prefix);
+            memcpy(b->buf + b->len, b->buf + start, prefix);
+            b->len += prefix;
+        }
+        put_csv(b, intern_lookup_text(&g_names, rr->owner));
+        put_byte(b, ',');
+        put_type(b, rr->type);
+        put_byte(b, ',');
+        put_u64(b, MAX(rr->ttl, 0));
+        put_byte(b, ',');
+        String rdata = {0};
+        (void)format_rdata(&rdata, rr);
+        put_csv(b, rdata);
+        put_byte(b, '\n');
+    }
+}
+
+internal void
+format_binary(Output_Buffer *b, String name, u16 qtype, Resolution *resolution)
+{
+    // NOTE(ariel) Bound the records in wire form by their rdata, which the
+    // parser keeps raw, or by the largest decoded rdata, i.e. that of SOA.
+    size_t bound = 0;
+    for (u32 i = 0; i < resolution->answer.count; ++i)
+        bound += 3 * DNS_DOMAIN_LIMIT + 32 + resolution->answer.rrs[i].rdlength;
+
+    size_t start = b->len;
+    put_be(b, 0, 4);
+    put_be(b, qtype, 2);
+    put_be(b, resolution->status, 1);
+    put_be(b, resolution->rcode, 1);
+    put_be(b, resolution->answer.count, 2);
+    put_be(b, MIN(name.len, UINT8_MAX), 1);
+    put(b, name.str, MIN(name.len, UINT8_MAX));
+
+    reserve(b, bound);
+    size_t len = format_records(b->buf + b->len, bound, resolution->answer);
+    if (!len && resolution->answer.count) err_exit("failed to serialize records of %.*s", (int)name.len, name.str);
+    b->len += len;
+
+    u32 entry = b->len - start - 4;
+    for (u32 i = 0; i < 4; ++i) b->buf[start + i] = entry >> 8 * (3 - i);
+}
+
+internal void
+format_result(Output *o, Output_Buffer *b, String name, u16 qtype, Resolution *resolution)
+{
+    switch (o->format) {
+        case OUTPUT_JSONL: format_jsonl(b, name, qtype, resolution); break;
+        case OUTPUT_CSV: format_csv(b, name, qtype, resolution); break;
+        case OUTPUT_BINARY: format_binary(b, name, qtype, resolution); break;
+        default: assert(!"UNREACHABLE");
+    }
+}
+
+
+/* ---
+ * Write chunks out in bulk.
+ * ---
+ */
+
+void
+output_flush(Output *o)
+{
+    struct iovec *iov = o->iov;
+    int count = o->chunk + 1;
+    while (count && !iov->iov_len) ++iov, --count;
+
+    while (count) {
+        ssize_t n = writev(o->fd, iov, count);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            err_exit("failed to write output");
+        }
+
+        // NOTE(ariel) Resume a partial write where it stopped.
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov, --count;
+        }
+        if (count) {
+            iov->iov_base = (u8 *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    for (u32 i = 0; i < OUTPUT_CHUNK_COUNT; ++i) {
+        o->iov[i].iov_base = o->chunks + (size_t)i * OUTPUT_CHUNK_SIZE;
+        o->iov[i].iov_len = 0;
+    }
+    o->chunk = 0;
+}
+
+internal void
+append(Output *o, u8 *data, size_t len)
+{
+    while (len) {
+        struct iovec *iov = &o->iov[o->chunk];
+        size_t room = OUTPUT_CHUNK_SIZE - iov->iov_len;
+        if (!room) {
+            if (o->chunk + 1 == OUTPUT_CHUNK_COUNT) output_flush(o);
+            else ++o->chunk;
+            continue;
+        }
+
+        size_t n = MIN(room, len);
+        memcpy((u8 *)iov->iov_base + iov->iov_len, data, n);
+        iov->iov_len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+
+/* ---
+ * Interface.
+ * ---
+ */
+
+Output_Format
+output_format_from_string(char *s)
+{
+    for (Output_Format format = 0; format < OUTPUT_FORMAT_COUNT; ++format) {
+        if (!strcmp(s, OUTPUT_FORMAT_STRING[format])) return format;
+    }
+    return OUTPUT_FORMAT_COUNT;
+}
+
+void
+output_init(Output *o, int fd, Output_Format format, u32 window)
+{
+    *o = (Output){
+        .fd = fd,
+        .format = format,
+        .window = window,
+        .chunks = malloc((size_t)OUTPUT_CHUNK_COUNT * OUTPUT_CHUNK_SIZE),
+    };
+    if (window) o->pending = calloc(window, sizeof(Output_Buffer));
+    if (!o->chunks || (window && !o->pending)) err_exit("failed to allocate memory for output");
+
+    // NOTE(ariel) Flushing nothing lays out the empty chunks.
+    output_flush(o);
+
+    if (format == OUTPUT_CSV) {
+        append(o, (u8 *)OUTPUT_CSV_HEADER, sizeof(OUTPUT_CSV_HEADER) - 1);
+    } else if (format == OUTPUT_BINARY) {
+        u8 header[] = { 'D', 'N', 'S', 'O', OUTPUT_VERSION >> 8, OUTPUT_VERSION & 0xff };
+        append(o, header, sizeof(header));
+    }
+}
+
+void
+output_release(Output *o)
+{
+    output_flush(o);
+    for (u32 i = 0; i < o->window; ++i) free(o->pending[i].buf);
+    free(o->pending);
+    free(o->scratch.buf);
+    free(o->chunks);
+    *o = (Output){0};
+}
+
+bool
+output_admits(Output *o, u64 seq)
+{
+    return !o->window || seq < o->next + o->window;
+}
+
+void
+output_write(Output *o, u64 seq, String name, u16 qtype, Resolution *resolution)
+{
+    if (!o->window) {
+        o->scratch.len = 0;
+        format_result(o, &o->scratch, name, qtype, resolution);
+        append(o, o->scratch.buf, o->scratch.len);
+        return;
+    }
+
+    assert(seq >= o->next && output_admits(o, seq));
+    Output_Buffer *b = &o->pending[seq % o->window];
+    assert(!b->ready);
+    b->len = 0;
+    format_result(o, b, name, qtype, resolution);
+    b->ready = true;
+
+    for (b = &o->pending[o->next % o->window]; b->ready; b = &o->pending[o->next % o->window]) {
+        append(o, b->buf, b->len);
+        b->ready = false;
+        ++o->next;
+    }
+}
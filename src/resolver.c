@@ -4,32 +4,164 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <arpa/inet.h>
+#include <unistd.h>
+
 #include "arena.h"
+#include "bulk.h"
 #include "common.h"
 #include "dns.h"
 #include "err_exit.h"
+#include "forward.h"
+#include "hosts.h"
+#include "intern.h"
+#include "output.h"
+#include "root.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
 
 internal inline void
 usage(char *program)
 {
-    fprintf(stderr, "usage: %s hostname\n", program);
+    fprintf(stderr,
+            "usage: %s [options] [-o jsonl|csv|binary] hostname [type]\n"
+            "       %s [options] [-o jsonl|csv|binary] -x address\n"
+            "       %s [options] [-o jsonl|csv|binary] -b names-file [-c concurrency] [-k window] [type]\n"
+            "       %s [options] [-o jsonl|csv|binary] -b addresses-file -x [-c concurrency] [-k window]\n"
+            "       %s [options] -l port [-w workers] [-m cache-megabytes] [-p] [-S]\n"
+            "options: [-t trace-file] [-T sample-rate] [-r root-zone] [-H hosts-file]...\n"
+            "         [-f upstream[#port]]... [-F round-robin|least-outstanding|fastest]\n",
+            program, program, program, program, program);
     exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
-    char *program = *argv++;
-    if (argc != 2) usage(program);
+    char *program = argv[0];
+    char *trace_path = 0;
+    char *root_zone = 0;
+    char *hosts[HOSTS_FILE_LIMIT] = {0};
+    u32 hosts_count = 0;
+    char *upstreams[FORWARD_UPSTREAM_LIMIT] = {0};
+    u32 upstream_count = 0;
+    Forward_Policy policy = FORWARD_ROUND_ROBIN;
+    Output_Format format = OUTPUT_FORMAT_COUNT;
+    u32 sample_rate = 1;
+    Server_Config server = {0};
+    Bulk_Config bulk = {0};
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:T:r:H:f:F:o:b:xc:k:l:w:m:pS")) != -1) {
+        switch (opt) {
+            case 't': trace_path = optarg; break;
+            case 'T': sample_rate = strtoul(optarg, 0, 10); break;
+            case 'r': root_zone = optarg; break;
+            case 'H': {
+                if (hosts_count == HOSTS_FILE_LIMIT) err_exit("exceeded limit of %d hosts files", HOSTS_FILE_LIMIT);
+                hosts[hosts_count++] = optarg;
+                break;
+            }
+            case 'f': {
+                if (upstream_count == FORWARD_UPSTREAM_LIMIT) err_exit("exceeded limit of %d upstreams", FORWARD_UPSTREAM_LIMIT);
+                upstreams[upstream_count++] = optarg;
+                break;
+            }
+            case 'F': {
+                policy = forward_policy_from_string(optarg);
+                if (policy == FORWARD_POLICY_COUNT) err_exit("unsupported policy of forwarding %s", optarg);
+                break;
+            }
+            case 'o': {
+                format = output_format_from_string(optarg);
+                if (format == OUTPUT_FORMAT_COUNT) err_exit("unsupported format of output %s", optarg);
+                break;
+            }
+            case 'b': bulk.input = optarg; break;
+            case 'x': bulk.reverse = true; break;
+            case 'c': bulk.concurrency = strtoul(optarg, 0, 10); break;
+            case 'k': bulk.window = strtoul(optarg, 0, 10); break;
+            case 'l': server.port = strtoul(optarg, 0, 10); break;
+            case 'w': server.workers = strtoul(optarg, 0, 10); break;
+            case 'm': server.cache_limit = (size_t)strtoul(optarg, 0, 10) << 20; break;
+            case 'p': server.pin = true; break;
+            case 'S': server.share = true; break;
+            default: usage(program);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    stats_init();
+    if (trace_path) trace_init(trace_path, sample_rate);
+    // NOTE(ariel) Load overrides before any other thread starts, so every
+    // thread inherits the mask that leaves SIGHUP to the thread that reloads.
+    if (hosts_count) hosts_init(hosts, hosts_count);
+    if (root_zone) root_zone_init(root_zone);
+    if (upstream_count) forward_init(upstreams, upstream_count, policy);
+
+    if (server.port) {
+        if (argc != 0 || bulk.reverse) usage(program);
+        server_wait(server_start(server));
+        exit(0);
+    }
+
+    if (bulk.input) {
+        if (argc > 1 || (bulk.reverse && argc)) usage(program);
+        bulk.qtype = bulk.reverse ? RR_TYPE_PTR : RR_TYPE_A;
+        if (argc == 1) {
+            bulk.qtype = rr_type_from_string((String){ .str = (u8 *)argv[0], .len = strlen(argv[0]) });
+            if (!bulk.qtype) err_exit("unsupported type of resource record %s", argv[0]);
+        }
+        bulk.format = format == OUTPUT_FORMAT_COUNT ? OUTPUT_JSONL : format;
+        bulk_run(bulk);
+        exit(0);
+    }
+
+    if (argc != 1 && argc != 2) usage(program);
+    if (bulk.reverse && argc != 1) usage(program);
 
     arena_init(&g_arena);
+    intern_init(&g_names);
+    stats_thread_init();
 
     String domain = {
-        .str = (u8 *)*argv,
-        .len = strlen(*argv),
+        .str = (u8 *)argv[0],
+        .len = strlen(argv[0]),
     };
-    output_address(resolve(domain));
 
+    u16 qtype = RR_TYPE_A;
+    if (bulk.reverse) {
+        u8 addr[16] = {0};
+        int family = inet_pton(AF_INET, argv[0], addr) == 1 ? AF_INET : AF_INET6;
+        errno = 0;
+        if (family == AF_INET6 && inet_pton(AF_INET6, argv[0], addr) != 1) err_exit("invalid address %s", argv[0]);
+        domain = intern_lookup_text(&g_names, reverse_name(family, addr));
+        qtype = RR_TYPE_PTR;
+    } else if (argc == 2) {
+        String type = {
+            .str = (u8 *)argv[1],
+            .len = strlen(argv[1]),
+        };
+        qtype = rr_type_from_string(type);
+        if (!qtype) err_exit("unsupported type of resource record %s", argv[1]);
+    }
+
+    Resolution resolution = resolve(domain, qtype);
+    if (format != OUTPUT_FORMAT_COUNT) {
+        // NOTE(ariel) Machine-readable output reports failures as results.
+        Output output = {0};
+        output_init(&output, STDOUT_FILENO, format, 0);
+        output_write(&output, 0, domain, qtype, &resolution);
+        output_release(&output);
+    } else {
+        if (resolution.status) err_exit("%s", DNS_STATUS_STRING[resolution.status]);
+        output_answer(resolution.answer);
+    }
+
+    resolve_release();
+    intern_release(&g_names);
     arena_release(&g_arena);
     exit(0);
 }
@@ -0,0 +1,553 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "common.h"
+#include "dns.h"
+#include "epoch.h"
+#include "err_exit.h"
+#include "root.h"
+#include "str.h"
+
+enum {
+    ROOT_ZONE_TOKEN_LIMIT = 8,
+    ROOT_ZONE_ERROR_LIMIT = 256,
+    ROOT_ZONE_CHECK_MS    = 1000,
+};
+
+// NOTE(ariel) Names are in lowercase presentation form without the final
+// dot. They point into the arena of text, which never moves.
+typedef struct {
+    String name;
+    bool has_a;
+    bool has_aaaa;
+    u8 a[4];
+    u8 aaaa[16];
+} Root_Host;
+
+typedef struct {
+    String tld;
+    String host;
+} Root_Delegation;
+
+typedef struct {
+    String label;
+    u32 first;
+    u32 count;
+} Root_TLD;
+
+typedef struct {
+    Arena text;
+    Arena hosts;
+    Arena records;
+
+    Root_Host *host;
+    u32 host_count;
+    Root_Delegation *delegation;
+    u32 delegation_count;
+
+    // NOTE(ariel) Index of TLDs, sorted by label, and for each one a range of
+    // hosts that serve it.
+    Root_TLD *tld;
+    u32 tld_count;
+    u32 *servers;
+
+    u32 serial;
+    struct stat st;
+} Root_Zone;
+
+typedef struct {
+    String origin;
+    String owner;
+    u8 *cur;
+    u8 *end;
+    u32 line;
+    u32 record_line;
+    char error[ROOT_ZONE_ERROR_LIMIT];
+} Zone_Parser;
+
+global Root_Zone *g_root_zone;
+global Epoch g_root_zone_epoch;
+global _Thread_local u32 t_rotation;
+
+
+/* ---
+ * Parse the zone file.
+ * ---
+ */
+
+internal int
+compare_names(String a, String b)
+{
+    int order = memcmp(a.str, b.str, MIN(a.len, b.len));
+    if (order) return order;
+    return (a.len > b.len) - (a.len < b.len);
+}
+
+internal int
+compare_hosts(const void *a, const void *b)
+{
+    return compare_names(((Root_Host *)a)->name, ((Root_Host *)b)->name);
+}
+
+internal int
+compare_delegations(const void *a, const void *b)
+{
+    const Root_Delegation *x = a;
+    const Root_Delegation *y = b;
+    int order = compare_names(x->tld, y->tld);
+    return order ? order : compare_names(x->host, y->host);
+}
+
+internal bool
+token_is(String token, char *text)
+{
+    return string_cmp_nocase(token, (String){ .str = (u8 *)text, .len = strlen(text) });
+}
+
+internal u32
+token_number(String token)
+{
+    // NOTE(ariel) Tokens point into the mapped file, which need not end in a
+    // terminating byte.
+    char text[16] = {0};
+    memcpy(text, token.str, MIN(token.len, sizeof(text) - 1));
+    return strtoul(text, 0, 10);
+}
+
+internal bool
+token_is_number(String token)
+{
+    for (size_t i = 0; i < token.len; ++i) {
+        if (token.str[i] < '0' || token.str[i] > '9') return false;
+    }
+    return token.len > 0;
+}
+
+// NOTE(ariel) Make a name from the file absolute and store it in lowercase
+// without the final dot.
+internal String
+absolute_name(Root_Zone *z, Zone_Parser *p, String token)
+{
+    if (token_is(token, "@")) return p->origin;
+
+    bool relative = !token.len || token.str[token.len - 1] != '.';
+    if (!relative) --token.len;
+
+    String name = {
+        .str = arena_alloc(&z->text, token.len + 1 + p->origin.len),
+        .len = token.len,
+    };
+    for (size_t i = 0; i < token.len; ++i) {
+        u8 c = token.str[i];
+        name.str[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    if (relative && p->origin.len) {
+        name.str[name.len++] = '.';
+        memcpy(name.str + name.len, p->origin.str, p->origin.len);
+        name.len += p->origin.len;
+    }
+    return name;
+}
+
+// NOTE(ariel) Split the next record of the file into tokens. A record ends at
+// the end of a line outside of parentheses.
+internal u32
+next_record(Zone_Parser *p, String *tokens, bool *continued)
+{
+    u32 count = 0;
+    i32 depth = 0;
+    *continued = p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t');
+
+    while (p->cur < p->end) {
+        u8 c = *p->cur;
+        if (c == ' ' || c == '\t' || c == '\r') {
+            ++p->cur;
+        } else if (c == ';') {
+            while (p->cur < p->end && *p->cur != '\n') ++p->cur;
+        } else if (c == '\n') {
+            ++p->cur;
+            ++p->line;
+            if (!depth && count) break;
+            if (!depth) *continued = p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t');
+        } else if (c == '(') {
+            ++depth;
+            ++p->cur;
+        } else if (c == ')') {
+            --depth;
+            ++p->cur;
+        } else {
+            u8 *start = p->cur;
+            if (c == '"') {
+                for (++p->cur; p->cur < p->end && *p->cur != '"'; ++p->cur) {
+                    if (*p->cur == '\\') ++p->cur;
+                }
+                if (p->cur < p->end) ++p->cur;
+            } else {
+                // NOTE(ariel) Search the separators by length, since a NUL
+                // byte in the file would match the terminator of a string.
+                while (p->cur < p->end && !memchr(" \t\r\n;()", *p->cur, 7)) ++p->cur;
+            }
+            if (!count) p->record_line = p->line;
+            if (count < ROOT_ZONE_TOKEN_LIMIT) {
+                tokens[count++] = (String){ .str = start, .len = p->cur - start };
+            }
+        }
+    }
+
+    return count;
+}
+
+internal bool
+parse_zone(Root_Zone *z, Zone_Parser *p)
+{
+    z->host = arena_alloc(&z->hosts, 0);
+    z->delegation = arena_alloc(&z->records, 0);
+
+    for (;;) {
+        bool continued = false;
+        String tokens[ROOT_ZONE_TOKEN_LIMIT] = {0};
+        u32 count = next_record(p, tokens, &continued);
+        if (!count) break;
+
+
+        /* ---
+         * Handle directives and the owner of the record.
+         * ---
+         */
+        u32 i = 0;
+        if (!continued && tokens[0].str[0] == '$') {
+            if (token_is(tokens[0], "$ORIGIN") && count >= 2) {
+                p->origin = (String){0};
+                p->origin = absolute_name(z, p, tokens[1]);
+            } else if (!token_is(tokens[0], "$TTL")) {
+                snprintf(p->error, sizeof(p->error), "unsupported directive %.*s on line %u",
+                        (int)tokens[0].len, tokens[0].str, p->record_line);
+                return false;
+            }
+            continue;
+        }
+        if (!continued) {
+            p->owner = absolute_name(z, p, tokens[i++]);
+        } else if (!p->owner.str) {
+            snprintf(p->error, sizeof(p->error), "record without owner on line %u", p->record_line);
+            return false;
+        }
+
+
+        /* ---
+         * Skip the TTL and class in either order, then read the type.
+         * ---
+         */
+        while (i < count && (token_is_number(tokens[i]) || token_is(tokens[i], "IN")
+                    || token_is(tokens[i], "CH") || token_is(tokens[i], "HS"))) {
+            ++i;
+        }
+        if (i == count) {
+            snprintf(p->error, sizeof(p->error), "record without type on line %u", p->record_line);
+            return false;
+        }
+        String type = tokens[i++];
+        String *rdata = &tokens[i];
+        u32 rdata_count = count - i;
+
+
+        /* ---
+         * Keep only the records that delegate from the root.
+         * ---
+         */
+        bool tld = p->owner.len && !memchr(p->owner.str, '.', p->owner.len);
+        if (token_is(type, "NS") && tld && rdata_count >= 1) {
+            z->delegation = arena_realloc(&z->records, (z->delegation_count + 1) * sizeof(Root_Delegation));
+            z->delegation[z->delegation_count++] = (Root_Delegation){
+                .tld = p->owner,
+                .host = absolute_name(z, p, rdata[0]),
+            };
+        } else if ((token_is(type, "A") || token_is(type, "AAAA")) && rdata_count >= 1) {
+            Root_Host host = { .name = p->owner };
+            char text[64] = {0};
+            memcpy(text, rdata[0].str, MIN(rdata[0].len, sizeof(text) - 1));
+            bool valid = token_is(type, "A")
+                ? (host.has_a = inet_pton(AF_INET, text, host.a) == 1)
+                : (host.has_aaaa = inet_pton(AF_INET6, text, host.aaaa) == 1);
+            if (!valid) {
+                snprintf(p->error, sizeof(p->error), "invalid address %s on line %u", text, p->record_line);
+                return false;
+            }
+            z->host = arena_realloc(&z->hosts, (z->host_count + 1) * sizeof(Root_Host));
+            z->host[z->host_count++] = host;
+        } else if (token_is(type, "SOA") && !p->owner.len && rdata_count >= 3) {
+            z->serial = token_number(rdata[2]);
+        }
+    }
+
+    return true;
+}
+
+internal Root_Host *
+find_host(Root_Zone *z, String name)
+{
+    u32 lo = 0;
+    u32 hi = z->host_count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        int order = compare_names(z->host[mid].name, name);
+        if (!order) return &z->host[mid];
+        if (order < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+internal void
+build_index(Root_Zone *z)
+{
+    // NOTE(ariel) Merge the addresses of each host into one entry.
+    qsort(z->host, z->host_count, sizeof(Root_Host), compare_hosts);
+    u32 hosts = 0;
+    for (u32 i = 0; i < z->host_count; ++i) {
+        Root_Host *host = &z->host[i];
+        Root_Host *last = hosts ? &z->host[hosts - 1] : 0;
+        if (last && !compare_names(last->name, host->name)) {
+            if (host->has_a && !last->has_a) memcpy(last->a, host->a, sizeof(host->a)), last->has_a = true;
+            if (host->has_aaaa && !last->has_aaaa) memcpy(last->aaaa, host->aaaa, sizeof(host->aaaa)), last->has_aaaa = true;
+        } else {
+            z->host[hosts++] = *host;
+        }
+    }
+    z->host_count = hosts;
+
+    // NOTE(ariel) Group delegations by TLD. A nameserver without an address
+    // in the zone cannot take a referral, so the index leaves it out.
+    qsort(z->delegation, z->delegation_count, sizeof(Root_Delegation), compare_delegations);
+    z->servers = arena_alloc(&z->records, z->delegation_count * sizeof(u32));
+    z->tld = arena_alloc(&z->records, z->delegation_count * sizeof(Root_TLD));
+
+    u32 servers = 0;
+    for (u32 i = 0; i < z->delegation_count; ++i) {
+        Root_Delegation *d = &z->delegation[i];
+        if (!z->tld_count || compare_names(z->tld[z->tld_count - 1].label, d->tld)) {
+            z->tld[z->tld_count++] = (Root_TLD){ .label = d->tld, .first = servers };
+        }
+
+        Root_Host *host = find_host(z, d->host);
+        if (host) {
+            z->servers[servers++] = host - z->host;
+            ++z->tld[z->tld_count - 1].count;
+        }
+    }
+}
+
+internal void
+release_zone(Root_Zone *z)
+{
+    arena_release(&z->text);
+    arena_release(&z->hosts);
+    arena_release(&z->records);
+    free(z);
+}
+
+internal Root_Zone *
+load_zone(char *path, char *error, size_t cap)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        snprintf(error, cap, "failed to open root zone %s (%s)", path, strerror(errno));
+        return 0;
+    }
+
+    Root_Zone *z = calloc(1, sizeof(Root_Zone));
+    if (!z) {
+        close(fd);
+        snprintf(error, cap, "failed to allocate root zone");
+        return 0;
+    }
+    arena_init(&z->text);
+    arena_init(&z->hosts);
+    arena_init(&z->records);
+
+    u8 *file = MAP_FAILED;
+    if (fstat(fd, &z->st) == -1) goto fail;
+    if (z->st.st_size) {
+        file = mmap(0, z->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file == MAP_FAILED) goto fail;
+    }
+
+    Zone_Parser p = {
+        .cur = file == MAP_FAILED ? 0 : file,
+        .end = file == MAP_FAILED ? 0 : file + z->st.st_size,
+        .line = 1,
+    };
+    bool parsed = parse_zone(z, &p);
+    if (file != MAP_FAILED) munmap(file, z->st.st_size);
+    close(fd);
+
+    if (!parsed) {
+        snprintf(error, cap, "%.128s: %.120s", path, p.error);
+        release_zone(z);
+        return 0;
+    }
+
+    build_index(z);
+    if (!z->tld_count) {
+        snprintf(error, cap, "%s: root zone delegates no TLD", path);
+        release_zone(z);
+        return 0;
+    }
+    return z;
+
+fail:
+    snprintf(error, cap, "failed to read root zone %s (%s)", path, strerror(errno));
+    close(fd);
+    release_zone(z);
+    return 0;
+}
+
+
+/* ---
+ * Watch the file and swap in new zones.
+ * ---
+ */
+
+internal bool
+same_file(struct stat *a, struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+internal void *
+watch(void *arg)
+{
+    char *path = arg;
+
+    for (;;) {
+        struct timespec interval = { .tv_sec = ROOT_ZONE_CHECK_MS / 1000 };
+        nanosleep(&interval, 0);
+
+        Root_Zone *current = __atomic_load_n(&g_root_zone, __ATOMIC_ACQUIRE);
+        struct stat st = {0};
+        if (stat(path, &st) == -1 || same_file(&st, &current->st)) continue;
+
+        char error[ROOT_ZONE_ERROR_LIMIT] = {0};
+        Root_Zone *z = load_zone(path, error, sizeof(error));
+        if (!z) {
+            // NOTE(ariel) Keep the zone in use, and do not retry until the
+            // file changes again.
+            fprintf(stderr, "error: %s, keeping root zone %u\n", error, current->serial);
+            current->st = st;
+            continue;
+        }
+
+        // NOTE(ariel) Free the replaced zone once no referral can still read
+        // it.
+        __atomic_store_n(&g_root_zone, z, __ATOMIC_SEQ_CST);
+        epoch_wait(&g_root_zone_epoch);
+        release_zone(current);
+    }
+
+    return 0;
+}
+
+void
+root_zone_init(char *path)
+{
+    char error[ROOT_ZONE_ERROR_LIMIT] = {0};
+    Root_Zone *z = load_zone(path, error, sizeof(error));
+    if (!z) {
+        errno = 0;
+        err_exit("%s", error);
+    }
+    __atomic_store_n(&g_root_zone, z, __ATOMIC_RELEASE);
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, watch, path)) err_exit("failed to start thread to watch root zone");
+    pthread_detach(thread);
+}
+
+
+/* ---
+ * Refer names to the nameservers of their TLD.
+ * ---
+ */
+
+internal Root_Zone_Answer
+refer(Root_Zone *z, String wire, sockaddr_storage *addr, String *ns)
+{
+    // NOTE(ariel) The last label of the name in wire form is its TLD. The
+    // interned wire form is already in lowercase.
+    size_t last = 0;
+    for (size_t i = 0; wire.str[i]; i += 1 + wire.str[i]) last = i;
+    String label = { .str = wire.str + last + 1, .len = wire.str[last] };
+
+    u32 lo = 0;
+    u32 hi = z->tld_count;
+    Root_TLD *found = 0;
+    while (lo < hi && !found) {
+        u32 mid = lo + (hi - lo) / 2;
+        int order = compare_names(z->tld[mid].label, label);
+        if (!order) found = &z->tld[mid];
+        else if (order < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!found) return ROOT_ZONE_NXDOMAIN;
+
+
+    /* ---
+     * Spread referrals over the nameservers of the TLD, preferring IPv4.
+     * ---
+     */
+    Root_Host *fallback = 0;
+    u32 rotation = t_rotation++;
+    for (u32 i = 0; i < found->count; ++i) {
+        Root_Host *host = &z->host[z->servers[found->first + (rotation + i) % found->count]];
+        if (host->has_a) {
+            sockaddr_in *sa = (sockaddr_in *)addr;
+            *addr = (sockaddr_storage){0};
+            sa->sin_family = AF_INET;
+            sa->sin_port = DNS_PORT;
+            memcpy(&sa->sin_addr, host->a, sizeof(host->a));
+            *ns = host->name;
+            return ROOT_ZONE_REFERRAL;
+        }
+        if (host->has_aaaa && !fallback) fallback = host;
+    }
+    if (!fallback) return ROOT_ZONE_MISS;
+
+    sockaddr_in6 *sa = (sockaddr_in6 *)addr;
+    *addr = (sockaddr_storage){0};
+    sa->sin6_family = AF_INET6;
+    sa->sin6_port = DNS_PORT;
+    memcpy(&sa->sin6_addr, fallback->aaaa, sizeof(fallback->aaaa));
+    *ns = fallback->name;
+    return ROOT_ZONE_REFERRAL;
+}
+
+Root_Zone_Answer
+root_zone_refer(String wire, sockaddr_storage *addr, String *ns)
+{
+    if (!__atomic_load_n(&g_root_zone, __ATOMIC_RELAXED) || wire.len < 2) return ROOT_ZONE_MISS;
+
+    u32 parity = epoch_enter(&g_root_zone_epoch);
+    Root_Zone *z = __atomic_load_n(&g_root_zone, __ATOMIC_ACQUIRE);
+    Root_Zone_Answer answer = refer(z, wire, addr, ns);
+
+    // NOTE(ariel) The name of the nameserver lives in the zone, which may go
+    // once the lookup ends, so copy it.
+    if (answer == ROOT_ZONE_REFERRAL) {
+        String name = { .str = arena_alloc(&g_arena, ns->len), .len = ns->len };
+        memcpy(name.str, ns->str, ns->len);
+        *ns = name;
+    }
+    epoch_exit(&g_root_zone_epoch, parity);
+    return answer;
+}
@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "cache.h"
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "intern.h"
+#include "server.h"
+#include "stats.h"
+
+enum {
+    SERVER_POLL_MS = 100,   // NOTE(ariel) Wake up periodically to notice when the server stops.
+    SERVER_BATCH = 64,
+    SERVER_PENDING_BUCKETS = 1 << 14,
+};
+
+typedef struct Worker Worker;
+
+// NOTE(ariel) A query of a client whose resolution is in flight, with what
+// its response echoes: the ID, the flags and the question, whose name keeps
+// the case the client gave it.
+typedef struct Pending Pending;
+struct Pending {
+    Pending *next;
+    Worker *worker;
+    u32 bucket;
+
+    sockaddr_storage client;
+    socklen_t socklen;
+
+    u16 id;
+    u16 flags;
+    Name_ID name;
+    u16 qtype;
+    u16 qclass;
+    u8 qname[DNS_DOMAIN_LIMIT];
+    u16 qname_len;
+};
+
+struct Worker {
+    Server *server;
+    u32 index;
+    int sockfd;
+    pthread_t thread;
+
+    // NOTE(ariel) Queries in flight, keyed by the address of the client and
+    // the ID of the query, and recycled ones.
+    Resolver *resolver;
+    Pending *pending[SERVER_PENDING_BUCKETS];
+    Pending *free;
+    u32 active;
+
+    Cache cache;
+};
+
+struct Server {
+    Server_Config config;
+    bool running;
+    Worker *workers;
+    Shared_Cache shared;
+};
+
+internal int
+open_socket(u16 port)
+{
+    int sockfd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sockfd == -1) err_exit("failed to open socket for server");
+
+    int yes = 1;
+    int no = 0;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)
+        err_exit("failed to set SO_REUSEPORT on socket of server");
+    if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no)) == -1)
+        err_exit("failed to accept IPv4 on socket of server");
+
+    // NOTE(ariel) Queries queue here while the worker drives resolutions, so
+    // absorb bursts in a deep buffer. The kernel caps it silently.
+    int size = MB(1);
+    (void)setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(port),
+        .sin6_addr = in6addr_any,
+    };
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        err_exit("failed to bind socket of server to port %u", port);
+
+    return sockfd;
+}
+
+
+/* ---
+ * Track queries in flight.
+ * ---
+ */
+
+internal u32
+pending_bucket(sockaddr_storage *client, socklen_t socklen, u16 id)
+{
+    u64 hash = string_hash((String){ .str = (u8 *)client, .len = socklen });
+    return (hash ^ id * 0x9e3779b97f4a7c15ull) & (SERVER_PENDING_BUCKETS - 1);
+}
+
+internal Pending *
+find_pending(Worker *worker, u32 bucket, sockaddr_storage *client, socklen_t socklen, u16 id)
+{
+    for (Pending *p = worker->pending[bucket]; p; p = p->next) {
+        if (p->id == id && p->socklen == socklen && !memcmp(&p->client, client, socklen)) return p;
+    }
+    return 0;
+}
+
+internal void
+release_pending(Pending *p)
+{
+    Worker *worker = p->worker;
+    Pending **link = &worker->pending[p->bucket];
+    while (*link != p) link = &(*link)->next;
+    *link = p->next;
+    --worker->active;
+
+    p->next = worker->free;
+    worker->free = p;
+}
+
+
+/* ---
+ * Answer queries.
+ * ---
+ */
+
+internal void
+respond(Worker *worker, DNS_Query *query, Resolution *resolution, sockaddr_storage *client, socklen_t socklen)
+{
+    u8 response[UDP_MSG_LIMIT] = {0};
+    size_t n = format_response(response, sizeof(response), query, resolution);
+    if (n) (void)sendto(worker->sockfd, response, n, 0, (sockaddr *)client, socklen);
+}
+
+// NOTE(ariel) Refuse a message with its header alone, since its question may
+// not even parse.
+internal void
+reject(Worker *worker, u8 *msg, u16 rcode, sockaddr_storage *client, socklen_t socklen)
+{
+    u16 flags = (msg[2] << 8 | msg[3]) & (DNS_HEADER_MASK_OP | DNS_HEADER_FLAG_RD);
+    flags |= DNS_HEADER_FLAG_QR | DNS_HEADER_FLAG_RA | rcode;
+    u8 response[DNS_HEADER_LIMIT] = { msg[0], msg[1], flags >> 8, flags };
+    (void)sendto(worker->sockfd, response, sizeof(response), 0, (sockaddr *)client, socklen);
+}
+
+internal void
+resolved(void *user, Resolution *resolution)
+{
+    Pending *p = user;
+    DNS_Query query = {
+        .header = { .id = p->id, .flags = p->flags },
+        .question = {
+            .wire = { .str = p->qname, .len = p->qname_len },
+            .name = p->name,
+            .qtype = p->qtype,
+            .qclass = p->qclass,
+        },
+    };
+    respond(p->worker, &query, resolution, &p->client, p->socklen);
+    release_pending(p);
+}
+
+internal void
+answer(Worker *worker, u8 *buf, ssize_t len, sockaddr_storage *client, socklen_t socklen)
+{
+    if (len < DNS_HEADER_LIMIT) return;
+    u16 flags = buf[2] << 8 | buf[3];
+    if (flags & DNS_HEADER_FLAG_QR) return;
+
+    // NOTE(ariel) Only standard queries of a single question go on to the
+    // resolver. Other opcodes, e.g. NOTIFY or UPDATE, get NOTIMP, and queries
+    // that fail to parse, e.g. with no question or several, get FORMERR.
+    if (flags & DNS_HEADER_MASK_OP) {
+        reject(worker, buf, DNS_RCODE_NOTIMP, client, socklen);
+        return;
+    }
+    DNS_Query query = {0};
+    String msg = { .str = buf, .len = len };
+    if (!parse_reply(&query, msg)) {
+        reject(worker, buf, DNS_RCODE_FORMERR, client, socklen);
+        return;
+    }
+
+    // NOTE(ariel) A client that retransmits its query before the response
+    // arrives waits for the resolution already in flight.
+    u32 bucket = pending_bucket(client, socklen, query.header.id);
+    if (find_pending(worker, bucket, client, socklen, query.header.id)) return;
+
+    Pending *p = worker->free;
+    if (p) {
+        worker->free = p->next;
+    } else if (!(p = malloc(sizeof(Pending)))) {
+        respond(worker, &query, &(Resolution){ .status = DNS_ERR_BUSY }, client, socklen);
+        return;
+    }
+
+    *p = (Pending){
+        .next = worker->pending[bucket],
+        .worker = worker,
+        .bucket = bucket,
+        .client = *client,
+        .socklen = socklen,
+        .id = query.header.id,
+        .flags = query.header.flags,
+        .name = query.question.name,
+        .qtype = query.question.qtype,
+        .qclass = query.question.qclass,
+    };
+    if (query.question.wire.len <= sizeof(p->qname)) {
+        memcpy(p->qname, query.question.wire.str, query.question.wire.len);
+        p->qname_len = query.question.wire.len;
+    }
+    worker->pending[bucket] = p;
+    ++worker->active;
+
+    // NOTE(ariel) An answer from the cache or the overrides completes before
+    // the resolver returns.
+    DNS_Status status = resolver_start(worker->resolver, p->name, p->qtype, resolved, p);
+    if (status) {
+        release_pending(p);
+        respond(worker, &query, &(Resolution){ .status = status }, client, socklen);
+    }
+}
+
+internal void
+begin_epoch(Worker *worker)
+{
+    Server_Config *config = &worker->server->config;
+    intern_init(&g_names);
+    cache_init(&worker->cache, config->cache_capacity, config->cache_limit);
+    t_cache = &worker->cache;
+}
+
+internal void
+end_epoch(Worker *worker)
+{
+    t_cache = 0;
+    cache_release(&worker->cache);
+    intern_release(&g_names);
+}
+
+internal void *
+work(void *arg)
+{
+    Worker *worker = arg;
+    Server *server = worker->server;
+
+    arena_init(&g_arena);
+    stats_thread_init();
+    begin_epoch(worker);
+
+    worker->resolver = resolver_create();
+    if (!worker->resolver) err_exit("failed to create resolver of worker %u", worker->index);
+
+    if (server->config.worker_init) server->config.worker_init(worker->index);
+
+    // NOTE(ariel) Each worker runs an event loop over its socket and its
+    // resolver, so it takes in new queries while others await replies from
+    // nameservers.
+    u8 buf[UINT16_MAX];
+    while (__atomic_load_n(&server->running, __ATOMIC_RELAXED)) {
+        Arena_Checkpoint cp = arena_checkpoint_set(&g_arena);
+
+        // NOTE(ariel) The cache keys its entries by interned names, and every
+        // new name grows the table for good. Once it holds
+        // `SERVER_NAME_LIMIT` names, stop to take in queries, which wait in
+        // the socket meanwhile, let those in flight finish, and start over
+        // with an empty table and cache.
+        bool full = g_names.count >= SERVER_NAME_LIMIT;
+        if (full && !worker->active) {
+            end_epoch(worker);
+            begin_epoch(worker);
+            full = false;
+        }
+
+        i64 wait = resolver_timeout(worker->resolver);
+        int timeout = wait < 0 ? SERVER_POLL_MS : MIN((wait + 999999) / 1000000, SERVER_POLL_MS);
+        struct pollfd fds[] = {
+            { .fd = worker->sockfd, .events = full ? 0 : POLLIN },
+            { .fd = resolver_fd(worker->resolver), .events = POLLIN },
+        };
+        (void)poll(fds, 2, timeout);
+
+        // NOTE(ariel) Take in a bounded batch of queries per turn, so a flood
+        // of them does not hold up the replies of the ones in flight.
+        for (u32 i = 0; i < SERVER_BATCH && (fds[0].revents & POLLIN); ++i) {
+            sockaddr_storage client = {0};
+            socklen_t socklen = sizeof(client);
+            ssize_t len = recvfrom(worker->sockfd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&client, &socklen);
+            if (len < 0) break;
+            if (len > 0) answer(worker, buf, len, &client, socklen);
+        }
+
+        // NOTE(ariel) Answers from the cache never touch the resolver, so
+        // only process it once replies arrive or a timer expires.
+        if ((fds[1].revents & POLLIN) || !resolver_timeout(worker->resolver)) resolver_process(worker->resolver);
+
+        arena_checkpoint_restore(cp);
+    }
+
+    resolver_destroy(worker->resolver);
+    for (u32 i = 0; i < SERVER_PENDING_BUCKETS; ++i) {
+        while (worker->pending[i]) release_pending(worker->pending[i]);
+    }
+    for (Pending *p = worker->free, *next = 0; p; p = next) {
+        next = p->next;
+        free(p);
+    }
+
+    end_epoch(worker);
+    arena_release(&g_arena);
+    return 0;
+}
+
+Server *
+server_start(Server_Config config)
+{
+    if (!config.workers) config.workers = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    if (!config.cache_capacity) config.cache_capacity = 1 << 16;
+    if (!config.cache_limit) config.cache_limit = MB(32);
+
+    Server *server = calloc(1, sizeof(Server));
+    Worker *workers = calloc(config.workers, sizeof(Worker));
+    if (!server || !workers) err_exit("failed to allocate server");
+
+    server->config = config;
+    server->running = true;
+    server->workers = workers;
+
+    if (config.share) {
+        shared_cache_init(&server->shared, config.cache_capacity * config.workers);
+        g_shared_cache = &server->shared;
+    }
+
+    // NOTE(ariel) Bind all sockets before any worker starts, so the caller
+    // learns of a port in use right away.
+    for (u32 i = 0; i < config.workers; ++i) {
+        workers[i].server = server;
+        workers[i].index = i;
+        workers[i].sockfd = open_socket(config.port);
+    }
+
+    long cpus = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    for (u32 i = 0; i < config.workers; ++i) {
+        if (pthread_create(&workers[i].thread, 0, work, &workers[i]))
+            err_exit("failed to start worker %u of server", i);
+
+        if (config.pin) {
+            cpu_set_t cpu;
+            CPU_ZERO(&cpu);
+            CPU_SET(i % cpus, &cpu);
+            if (pthread_setaffinity_np(workers[i].thread, sizeof(cpu), &cpu))
+                err_exit("failed to pin worker %u of server to CPU %ld", i, i % cpus);
+        }
+    }
+
+    return server;
+}
+
+void
+server_wait(Server *server)
+{
+    for (u32 i = 0; i < server->config.workers; ++i) pthread_join(server->workers[i].thread, 0);
+}
+
+void
+server_stop(Server *server)
+{
+    __atomic_store_n(&server->running, false, __ATOMIC_RELAXED);
+    server_wait(server);
+
+    for (u32 i = 0; i < server->config.workers; ++i) close(server->workers[i].sockfd);
+    if (server->config.share) {
+        g_shared_cache = 0;
+        shared_cache_release(&server->shared);
+    }
+    free(server->workers);
+    free(server);
+}
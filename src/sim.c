@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "dns.h"
+#include "err_exit.h"
+#include "sim.h"
+
+struct Sim_Packet {
+    u64 at;
+    u64 order;
+    i32 server;      // NOTE(ariel) The server bound to, or -1 for the resolver.
+    i32 origin;      // NOTE(ariel) The server a reply comes from.
+    u16 len;
+    u8 data[UDP_MSG_LIMIT];
+};
+
+
+/* ---
+ * Draw random numbers.
+ * ---
+ */
+
+double
+sim_random(Sim_Network *n)
+{
+    // NOTE(ariel) SplitMix64, which accepts any seed, zero included.
+    u64 z = (n->random += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (double)(z >> 11) / (double)(1ull << 53);
+}
+
+// NOTE(ariel) The natural logarithm of x > 0, to sample the exponential
+// distribution without a dependency on libm. Split x into m * 2^e with m in
+// [1, 2) and sum the series of atanh for ln(m), which converges fast there.
+internal double
+natural_log(double x)
+{
+    u64 bits = 0;
+    memcpy(&bits, &x, sizeof(bits));
+    i32 e = (i32)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & ((1ull << 52) - 1)) | 1023ull << 52;
+
+    double m = 0;
+    memcpy(&m, &bits, sizeof(m));
+    double s = (m - 1) / (m + 1);
+    double s2 = s * s;
+    double term = s;
+    double sum = 0;
+    for (u32 k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= s2;
+    }
+    return e * 0.6931471805599453 + 2 * sum;
+}
+
+internal u64
+sample_latency(Sim_Network *n, Sim_Link *link)
+{
+    switch (link->distribution) {
+        case SIM_LATENCY_UNIFORM:
+            return link->latency + (u64)(sim_random(n) * link->jitter);
+        case SIM_LATENCY_EXPONENTIAL:
+            return link->latency + (u64)(-natural_log(1.0 - sim_random(n)) * link->jitter);
+        default:
+            return link->latency;
+    }
+}
+
+internal inline bool
+chance(Sim_Network *n, double p)
+{
+    return p > 0 && sim_random(n) < p;
+}
+
+
+/* ---
+ * Keep messages in flight in order of delivery.
+ * ---
+ */
+
+internal inline bool
+earlier(Sim_Packet *a, Sim_Packet *b)
+{
+    return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+internal void
+swap_packets(Sim_Packet *a, Sim_Packet *b)
+{
+    Sim_Packet t = *a;
+    *a = *b;
+    *b = t;
+}
+
+internal Sim_Packet *
+push_packet(Sim_Network *n, u64 at, i32 server, i32 origin)
+{
+    if (n->packet_count == n->packet_cap) {
+        u32 cap = n->packet_cap ? n->packet_cap * 2 : 256;
+        Sim_Packet *packets = realloc(n->packets, cap * sizeof(Sim_Packet));
+        if (!packets) err_exit("failed to allocate packets of simulated network");
+        n->packets = packets;
+        n->packet_cap = cap;
+    }
+
+    u32 i = n->packet_count++;
+    n->packets[i] = (Sim_Packet){ .at = at, .order = n->order++, .server = server, .origin = origin };
+    while (i && earlier(&n->packets[i], &n->packets[(i - 1) / 2])) {
+        swap_packets(&n->packets[i], &n->packets[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+
+    // NOTE(ariel) The caller fills in the contents before the next push.
+    return &n->packets[i];
+}
+
+internal void
+pop_packet(Sim_Network *n, Sim_Packet *packet)
+{
+    *packet = n->packets[0];
+    n->packets[0] = n->packets[--n->packet_count];
+
+    u32 i = 0;
+    for (;;) {
+        u32 least = i;
+        u32 left = 2 * i + 1;
+        u32 right = left + 1;
+        if (left < n->packet_count && earlier(&n->packets[left], &n->packets[least])) least = left;
+        if (right < n->packet_count && earlier(&n->packets[right], &n->packets[least])) least = right;
+        if (least == i) break;
+        swap_packets(&n->packets[i], &n->packets[least]);
+        i = least;
+    }
+}
+
+
+/* ---
+ * Serve queries.
+ * ---
+ */
+
+internal bool
+same_addr(sockaddr_storage *a, sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family) return false;
+
+    if (a->ss_family == AF_INET) {
+        sockaddr_in *x = (sockaddr_in *)a;
+        sockaddr_in *y = (sockaddr_in *)b;
+        return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+    } else {
+        sockaddr_in6 *x = (sockaddr_in6 *)a;
+        sockaddr_in6 *y = (sockaddr_in6 *)b;
+        return x->sin6_port == y->sin6_port && !memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr));
+    }
+}
+
+internal Sim_Failure
+current_failure(Sim_Network *n, Sim_Link *link)
+{
+    if (n->now < link->failure_start) return SIM_FAILURE_NONE;
+    if (link->failure_end && n->now >= link->failure_end) return SIM_FAILURE_NONE;
+    return link->failure;
+}
+
+internal size_t
+fail_query(u8 *query, size_t len, u8 *reply, u8 rcode)
+{
+    // NOTE(ariel) Echo the header and question of the query and nothing else,
+    // which the resolver sends as the whole of its queries anyway.
+    memcpy(reply, query, len);
+    reply[2] |= DNS_HEADER_FLAG_QR >> 8;
+    reply[3] = (DNS_HEADER_FLAG_RA & 0xff) | rcode;
+    memset(&reply[6], 0, 6);
+    return len;
+}
+
+internal void
+serve(Sim_Network *n, Sim_Packet *query)
+{
+    Sim_Server *server = &n->servers[query->server];
+    Sim_Link *link = &server->link;
+    ++server->queries;
+
+    u8 reply[UDP_MSG_LIMIT];
+    size_t len = 0;
+    switch (current_failure(n, link)) {
+        case SIM_FAILURE_SILENT:
+            return;
+        case SIM_FAILURE_SERVFAIL:
+            len = fail_query(query->data, query->len, reply, DNS_RCODE_SERVFAIL);
+            break;
+        case SIM_FAILURE_REFUSED:
+            len = fail_query(query->data, query->len, reply, DNS_RCODE_REFUSED);
+            break;
+        default:
+            len = server->handler(server->user, query->data, query->len, reply, sizeof(reply));
+            break;
+    }
+    if (!len || chance(n, link->loss)) return;
+
+    u32 copies = 1 + chance(n, link->duplicate);
+    for (u32 i = 0; i < copies; ++i) {
+        Sim_Packet *packet = push_packet(n, n->now + sample_latency(n, link), -1, query->server);
+        memcpy(packet->data, reply, len);
+        packet->len = len;
+    }
+}
+
+
+/* ---
+ * Carry the messages of a resolver.
+ * ---
+ */
+
+internal bool
+sim_send(Transport *t, u8 *msg, size_t len, sockaddr_storage *to)
+{
+    // NOTE(ariel) A message to an address where no server listens vanishes,
+    // as it would on a network that filters ICMP. So does a lost one.
+    Sim_Network *n = (Sim_Network *)t;
+    for (u32 i = 0; i < n->server_count; ++i) {
+        Sim_Server *server = &n->servers[i];
+        if (!same_addr(&server->addr, to)) continue;
+        if (chance(n, server->link.loss)) break;
+
+        Sim_Packet *packet = push_packet(n, n->now + sample_latency(n, &server->link), i, -1);
+        memcpy(packet->data, msg, MIN(len, sizeof(packet->data)));
+        packet->len = MIN(len, sizeof(packet->data));
+        break;
+    }
+    return true;
+}
+
+internal ssize_t
+sim_recv(Transport *t, u8 *buf, size_t cap, sockaddr_storage *from)
+{
+    Sim_Network *n = (Sim_Network *)t;
+    while (n->packet_count && n->packets[0].at <= n->now) {
+        Sim_Packet packet;
+        pop_packet(n, &packet);
+        if (packet.server != -1) {
+            serve(n, &packet);
+            continue;
+        }
+
+        size_t len = MIN(packet.len, cap);
+        memcpy(buf, packet.data, len);
+        *from = n->servers[packet.origin].addr;
+        return len;
+    }
+    return -1;
+}
+
+internal u64
+sim_now(Transport *t)
+{
+    return ((Sim_Network *)t)->now;
+}
+
+internal bool
+sim_id(Transport *t, u16 *id)
+{
+    *id = sim_random((Sim_Network *)t) * 65536;
+    return true;
+}
+
+void
+sim_init(Sim_Network *n, u64 seed)
+{
+    *n = (Sim_Network){
+        .transport = {
+            .fd = -1,
+            .send = sim_send,
+            .recv = sim_recv,
+            .now = sim_now,
+            .id = sim_id,
+        },
+        .random = seed,
+    };
+}
+
+void
+sim_release(Sim_Network *n)
+{
+    free(n->packets);
+    n->packets = 0;
+    n->packet_count = n->packet_cap = 0;
+}
+
+Sim_Server *
+sim_add_server(Sim_Network *n, char *ip, Sim_Link link, Sim_Handler handler, void *user)
+{
+    errno = 0;
+    if (n->server_count == SIM_SERVER_LIMIT) err_exit("too many servers on simulated network");
+
+    Sim_Server *server = &n->servers[n->server_count++];
+    *server = (Sim_Server){ .link = link, .handler = handler, .user = user };
+
+    sockaddr_in *sa = (sockaddr_in *)&server->addr;
+    sockaddr_in6 *sa6 = (sockaddr_in6 *)&server->addr;
+    if (inet_pton(AF_INET, ip, &sa->sin_addr) == 1) {
+        sa->sin_family = AF_INET;
+        sa->sin_port = DNS_PORT;
+    } else if (inet_pton(AF_INET6, ip, &sa6->sin6_addr) == 1) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = DNS_PORT;
+    } else {
+        err_exit("invalid address of simulated server %s", ip);
+    }
+    return server;
+}
+
+
+/* ---
+ * Drive the virtual clock.
+ * ---
+ */
+
+void
+sim_run(Sim_Network *n, Resolver *r, u64 until)
+{
+    for (;;) {
+        resolver_process(r);
+
+        // NOTE(ariel) Jump to the next event, whichever comes first: the next
+        // delivery of a message or the next timer of the resolver.
+        u64 next = n->packet_count ? n->packets[0].at : UINT64_MAX;
+        i64 wait = resolver_timeout(r);
+        if (wait >= 0) next = MIN(next, n->now + wait);
+        if (next == UINT64_MAX || next > until) break;
+        n->now = MAX(n->now, next);
+    }
+
+    if (until != UINT64_MAX) n->now = MAX(n->now, until);
+}
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "common.h"
+#include "err_exit.h"
+#include "stats.h"
+
+_Thread_local Stats *t_stats = 0;
+
+global Stats *g_stats_threads[STAT_THREAD_LIMIT];
+global u32 g_stats_thread_count;
+
+global char *STAT_COUNTER_NAME[] = {
+    [STAT_QUERIES_SENT]      = "dnsresolver_queries_sent_total",
+    [STAT_TIMEOUTS]          = "dnsresolver_timeouts_total",
+    [STAT_MALFORMED_REPLIES] = "dnsresolver_malformed_replies_total",
+    [STAT_REFERRALS]         = "dnsresolver_referrals_total",
+    [STAT_FAILOVERS]         = "dnsresolver_failovers_total",
+    [STAT_CACHE_HITS]        = "dnsresolver_cache_hits_total",
+    [STAT_CACHE_MISSES]      = "dnsresolver_cache_misses_total",
+    [STAT_CACHE_EVICTIONS]   = "dnsresolver_cache_evictions_total",
+    [STAT_ARENA_GROWTHS]     = "dnsresolver_arena_growths_total",
+};
+
+global char *STAT_STAGE_NAME[] = {
+    [STAT_STAGE_SEND]    = "send",
+    [STAT_STAGE_WAIT]    = "wait",
+    [STAT_STAGE_PARSE]   = "parse",
+    [STAT_STAGE_ITERATE] = "iterate",
+    [STAT_STAGE_RESOLVE] = "resolve",
+};
+
+u64
+stats_now(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+u32
+stats_bucket(u64 ns)
+{
+    if (ns < STAT_SUB_BUCKET_COUNT) return ns;
+    u32 exponent = 63 - __builtin_clzll(ns);
+    u32 sub = (ns >> (exponent - STAT_SUB_BUCKET_BITS)) & (STAT_SUB_BUCKET_COUNT - 1);
+    return (exponent - STAT_SUB_BUCKET_BITS + 1) * STAT_SUB_BUCKET_COUNT + sub;
+}
+
+internal u64
+bucket_upper_bound(u32 bucket)
+{
+    if (bucket < STAT_SUB_BUCKET_COUNT) return bucket;
+    u32 exponent = bucket / STAT_SUB_BUCKET_COUNT + STAT_SUB_BUCKET_BITS - 1;
+    u64 sub = bucket % STAT_SUB_BUCKET_COUNT;
+    u64 width = (u64)1 << (exponent - STAT_SUB_BUCKET_BITS);
+    return ((u64)1 << exponent) + (sub + 1) * width - 1;
+}
+
+
+/* ---
+ * Format statistics in the text exposition format of Prometheus. A dump runs
+ * from a signal handler, so it avoids stdio and the heap entirely and builds
+ * its output in a static buffer, flushed with write(2).
+ * ---
+ */
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[KB(16)];
+} Dump;
+
+internal void
+dump_flush(Dump *d)
+{
+    size_t offset = 0;
+    while (offset < d->len) {
+        ssize_t n = write(d->fd, d->buf + offset, d->len - offset);
+        if (n <= 0) break;
+        offset += n;
+    }
+    d->len = 0;
+}
+
+internal void
+dump_str(Dump *d, char *s)
+{
+    for (; *s; ++s) {
+        if (d->len == sizeof(d->buf)) dump_flush(d);
+        d->buf[d->len++] = *s;
+    }
+}
+
+internal void
+dump_u64(Dump *d, u64 i)
+{
+    char digits[21] = {0};
+    int n = sizeof(digits) - 1;
+    do {
+        digits[--n] = '0' + i % 10;
+        i /= 10;
+    } while (i);
+    dump_str(d, digits + n);
+}
+
+global Dump g_dump;
+
+void
+stats_dump(int fd)
+{
+    Stats total = {0};
+
+    u32 threads = __atomic_load_n(&g_stats_thread_count, __ATOMIC_ACQUIRE);
+    for (u32 i = 0; i < MIN(threads, STAT_THREAD_LIMIT); ++i) {
+        Stats *s = __atomic_load_n(&g_stats_threads[i], __ATOMIC_ACQUIRE);
+        if (!s) continue;
+
+        for (u32 c = 0; c < STAT_COUNTER_COUNT; ++c)
+            total.counters[c] += __atomic_load_n(&s->counters[c], __ATOMIC_RELAXED);
+        for (u32 stage = 0; stage < STAT_STAGE_COUNT; ++stage) {
+            Stat_Histogram *h = &s->stages[stage];
+            for (u32 b = 0; b < STAT_BUCKET_COUNT; ++b)
+                total.stages[stage].buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            total.stages[stage].count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+            total.stages[stage].sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        }
+    }
+
+    Dump *d = &g_dump;
+    d->fd = fd;
+    d->len = 0;
+
+    for (u32 c = 0; c < STAT_COUNTER_COUNT; ++c) {
+        dump_str(d, "# TYPE ");
+        dump_str(d, STAT_COUNTER_NAME[c]);
+        dump_str(d, " counter\n");
+        dump_str(d, STAT_COUNTER_NAME[c]);
+        dump_str(d, " ");
+        dump_u64(d, total.counters[c]);
+        dump_str(d, "\n");
+    }
+
+    dump_str(d, "# TYPE dnsresolver_stage_latency_ns histogram\n");
+    for (u32 stage = 0; stage < STAT_STAGE_COUNT; ++stage) {
+        Stat_Histogram *h = &total.stages[stage];
+
+        // NOTE(ariel) Buckets of Prometheus are cumulative. Emit only the
+        // bounds where the count changes to keep the dump short.
+        u64 cumulative = 0;
+        for (u32 b = 0; b < STAT_BUCKET_COUNT; ++b) {
+            if (!h->buckets[b]) continue;
+            cumulative += h->buckets[b];
+            dump_str(d, "dnsresolver_stage_latency_ns_bucket{stage=\"");
+            dump_str(d, STAT_STAGE_NAME[stage]);
+            dump_str(d, "\",le=\"");
+            dump_u64(d, bucket_upper_bound(b));
+            dump_str(d, "\"} ");
+            dump_u64(d, cumulative);
+            dump_str(d, "\n");
+        }
+
+        dump_str(d, "dnsresolver_stage_latency_ns_bucket{stage=\"");
+        dump_str(d, STAT_STAGE_NAME[stage]);
+        dump_str(d, "\",le=\"+Inf\"} ");
+        dump_u64(d, h->count);
+        dump_str(d, "\ndnsresolver_stage_latency_ns_sum{stage=\"");
+        dump_str(d, STAT_STAGE_NAME[stage]);
+        dump_str(d, "\"} ");
+        dump_u64(d, h->sum);
+        dump_str(d, "\ndnsresolver_stage_latency_ns_count{stage=\"");
+        dump_str(d, STAT_STAGE_NAME[stage]);
+        dump_str(d, "\"} ");
+        dump_u64(d, h->count);
+        dump_str(d, "\n");
+    }
+
+    dump_flush(d);
+}
+
+internal void
+handle_dump_signal(int signal)
+{
+    (void)signal;
+    int errcode = errno;
+    stats_dump(STDERR_FILENO);
+    errno = errcode;
+}
+
+void
+stats_init(void)
+{
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR1, &sa, 0) == -1) err_exit("failed to install handler for SIGUSR1");
+}
+
+void
+stats_thread_init(void)
+{
+    if (t_stats) return;
+
+    u32 i = __atomic_fetch_add(&g_stats_thread_count, 1, __ATOMIC_ACQ_REL);
+    if (i >= STAT_THREAD_LIMIT) err_exit("exceeded limit of %d threads with statistics", STAT_THREAD_LIMIT);
+
+    t_stats = calloc(1, sizeof(Stats));
+    if (!t_stats) err_exit("failed to allocate statistics of thread");
+    __atomic_store_n(&g_stats_threads[i], t_stats, __ATOMIC_RELEASE);
+}
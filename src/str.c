@@ -1,165 +1,174 @@
 #include <string.h>
 
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
 #include "arena.h"
 #include "str.h"
 
-bool
-string_cmp(String s, String t)
+// NOTE(ariel) The routines below that scan names process 32 bytes at a time
+// with AVX2 or 16 bytes at a time with SSE2 when the compiler targets either,
+// and fall back to scalar loops otherwise. None of them read beyond the end
+// of a string, so the vector loops stop short and finish with scalar code.
+
+internal inline u8
+to_lower(u8 c)
 {
-    if (s.len != t.len) return false;
-    for (size_t i = 0; i < s.len; ++i) if (s.str[i] != t.str[i]) return false;
-    return true;
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
 }
 
-String
-string_dup(String s)
+#if defined(__AVX2__)
+internal inline __m256i
+to_lower_256(__m256i x)
 {
-    String t = {0};
+    __m256i upper = _mm256_and_si256(
+            _mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+    return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+#endif
 
-    t.len = s.len;
-    t.str = arena_alloc(&g_arena, t.len);
-    memmove(t.str, s.str, t.len);
+#if defined(__SSE2__)
+internal inline __m128i
+to_lower_128(__m128i x)
+{
+    // NOTE(ariel) Bytes at or above 0x80 compare as negative, so they never
+    // fall within the range of uppercase ASCII letters.
+    __m128i upper = _mm_and_si128(
+            _mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+            _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
 
-    return t;
+bool
+string_cmp(String s, String t)
+{
+    if (s.len != t.len) return false;
+    for (size_t i = 0; i < s.len; ++i) if (s.str[i] != t.str[i]) return false;
+    return true;
 }
 
-char *
-string_term(String s)
+bool
+string_cmp_nocase(String s, String t)
 {
-    char *t = arena_alloc(&g_arena, s.len + 1);
+    if (s.len != t.len) return false;
 
-    memcpy(t, s.str, s.len);
-    t[s.len] = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= s.len; i += 32) {
+        __m256i a = to_lower_256(_mm256_loadu_si256((__m256i *)(s.str + i)));
+        __m256i b = to_lower_256(_mm256_loadu_si256((__m256i *)(t.str + i)));
+        if ((u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xffffffff) return false;
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= s.len; i += 16) {
+        __m128i a = to_lower_128(_mm_loadu_si128((__m128i *)(s.str + i)));
+        __m128i b = to_lower_128(_mm_loadu_si128((__m128i *)(t.str + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) return false;
+    }
+#endif
+    for (; i < s.len; ++i) if (to_lower(s.str[i]) != to_lower(t.str[i])) return false;
 
-    return t;
+    return true;
 }
 
-void
-push_string_node(String_List *ls, String_Node *n)
+size_t
+string_find(String s, u8 c, size_t start)
 {
-    if (!ls->head) {
-        ls->head = n;
-    } else if (!ls->tail) {
-        ls->head->next = n;
-        ls->tail = n;
-    } else {
-        ls->tail->next = n;
-        ls->tail = n;
+    size_t i = start;
+#if defined(__AVX2__)
+    __m256i needle_256 = _mm256_set1_epi8(c);
+    for (; i + 32 <= s.len; i += 32) {
+        __m256i x = _mm256_loadu_si256((__m256i *)(s.str + i));
+        u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle_256));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i needle_128 = _mm_set1_epi8(c);
+    for (; i + 16 <= s.len; i += 16) {
+        __m128i x = _mm_loadu_si128((__m128i *)(s.str + i));
+        u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle_128));
+        if (mask) return i + __builtin_ctz(mask);
     }
-    ls->total_len += n->string.len;
-    ++ls->list_size;
+#endif
+    for (; i < s.len; ++i) if (s.str[i] == c) return i;
+
+    return s.len;
 }
 
-void
-push_string(String_List *ls, String s)
+internal inline u64
+hash_mix(u64 h, u64 w)
 {
-    String_Node *n = arena_alloc(&g_arena, sizeof(String_Node));
-    n->string = s;
-    push_string_node(ls, n);
+    h ^= w * 0x9e3779b97f4a7c15ull;
+    h = (h << 27 | h >> 37) * 0xff51afd7ed558ccdull;
+    return h;
 }
 
-String_List
-string_split(String s, u8 delim)
+u64
+string_hash(String s)
 {
-    String_List ls = {0};
-
-    for (size_t i = 0, prev_split = 0; i < s.len; ++i) {
-        if (s.str[i] == delim) {
-            String_Node *n = arena_alloc(&g_arena, sizeof(String_Node));
-            n->string.str = s.str + i + 1;
-            n->string.len = s.len - i - 1;
-            ls.total_len += n->string.len;
-            ++ls.list_size;
-
-            if (!ls.head) {
-                ls.head = arena_alloc(&g_arena, sizeof(String_Node));
-                ls.head->string.str = s.str;
-                ls.head->string.len = i;
-                ls.head->next = n;
-                ls.tail = n;
-                ls.total_len += i;
-                ++ls.list_size;
-            } else {
-                ls.total_len -= ls.tail->string.len;
-                ls.tail->string.len = i - prev_split - 1;
-                ls.total_len += ls.tail->string.len;
-
-                ls.tail->next = n;
-                ls.tail = n;
-            }
-
-            prev_split = i;
-        }
+    // NOTE(ariel) Hash the lowercase form of the string eight bytes at a
+    // time, so names that differ only in case hash equally, as they compare
+    // equally in `string_cmp_nocase()`. The vector and scalar paths consume
+    // identical words and so agree on every input.
+    u64 h = 0xcbf29ce484222325ull ^ s.len;
+
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= s.len; i += 32) {
+        u64 w[4] = {0};
+        _mm256_storeu_si256((__m256i *)w, to_lower_256(_mm256_loadu_si256((__m256i *)(s.str + i))));
+        for (u32 j = 0; j < 4; ++j) h = hash_mix(h, w[j]);
     }
-
-#ifdef DEBUG
-    size_t sum = 0;
-    String_Node *n = ls.head;
-    while (n) {
-        sum += n->string.len;
-        n = n->next;
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= s.len; i += 16) {
+        u64 w[2] = {0};
+        _mm_storeu_si128((__m128i *)w, to_lower_128(_mm_loadu_si128((__m128i *)(s.str + i))));
+        h = hash_mix(h, w[0]);
+        h = hash_mix(h, w[1]);
     }
-    assert(sum == ls.total_len);
 #endif
+    while (i < s.len) {
+        u8 bytes[8] = {0};
+        for (size_t j = 0; j < 8 && i < s.len; ++j, ++i) bytes[j] = to_lower(s.str[i]);
 
-    return ls;
+        u64 w = 0;
+        memcpy(&w, bytes, sizeof(w));
+        h = hash_mix(h, w);
+    }
+
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
 }
 
 String
-string_list_concat(String_List ls)
+string_dup(String s)
 {
-    String s = {
-        .str = arena_alloc(&g_arena, 0),
-    };
-
-    String_Node *n = ls.head;
-    while (n) {
-        String t = n->string;
-
-        s.str = arena_realloc(&g_arena, s.len + t.len);
-        memcpy(s.str + s.len, t.str, t.len);
-        s.len += t.len;
+    String t = {0};
 
-        n = n->next;
-    }
+    t.len = s.len;
+    t.str = arena_alloc(&g_arena, t.len);
+    memmove(t.str, s.str, t.len);
 
-    return s;
+    return t;
 }
 
-String
-string_list_join(String_List ls, u8 sep)
+char *
+string_term(String s)
 {
-    if (ls.list_size == 1) {
-        String t = ls.head->string;
-        String s = {
-            .str = arena_alloc(&g_arena, t.len),
-            .len = t.len,
-        };
-        memcpy(s.str, t.str, t.len);
-        return s;
-    }
+    char *t = arena_alloc(&g_arena, s.len + 1);
 
-    String s = {
-        .str = arena_alloc(&g_arena, 0),
-    };
-
-    String_Node *n = ls.head;
-    while (n) {
-        String t = n->string;
-
-        if (n != ls.tail) {
-            s.str = arena_realloc(&g_arena, s.len + t.len + 1);
-            memcpy(s.str + s.len, t.str, t.len);
-            s.len += t.len + 1;
-            s.str[s.len - 1] = sep;
-        } else {
-            s.str = arena_realloc(&g_arena, s.len + t.len);
-            memcpy(s.str + s.len, t.str, t.len);
-            s.len += t.len;
-        }
-
-        n = n->next;
-    }
+    memcpy(t, s.str, s.len);
+    t[s.len] = 0;
 
-    return s;
+    return t;
 }
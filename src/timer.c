@@ -0,0 +1,157 @@
+#include "common.h"
+#include "timer.h"
+
+internal inline u32
+level_shift(u32 level)
+{
+    return TIMER_LEVEL_BITS * level;
+}
+
+internal void
+link(Timer_Wheel *w, Timer *timer)
+{
+    // NOTE(ariel) A timer due in the current tick, which only happens as it
+    // cascades, lands in the slot the wheel is about to fire.
+    u64 delta = timer->expires - w->now;
+
+    u32 level = 0;
+    while (level < TIMER_LEVEL_COUNT - 1 && delta >> level_shift(level + 1)) ++level;
+    u32 slot = (timer->expires >> level_shift(level)) & TIMER_LEVEL_MASK;
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = 0;
+    timer->next = w->slots[level][slot];
+    if (timer->next) timer->next->prev = timer;
+    w->slots[level][slot] = timer;
+    w->occupied[level] |= 1ull << slot;
+}
+
+internal void
+unlink(Timer_Wheel *w, Timer *timer)
+{
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        w->slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+
+    if (!w->slots[timer->level][timer->slot]) w->occupied[timer->level] &= ~(1ull << timer->slot);
+    timer->next = timer->prev = 0;
+}
+
+void
+timer_start(Timer_Wheel *w, Timer *timer, u64 now, u64 timeout)
+{
+    if (timer->pending) timer_cancel(w, timer);
+
+    // NOTE(ariel) An empty wheel may lag arbitrarily far behind, so catch it
+    // up rather than walk every tick it missed.
+    u64 tick = now >> TIMER_TICK_SHIFT;
+    if (!w->count && w->now < tick) w->now = tick;
+
+    u64 expires = (now + timeout + (1ull << TIMER_TICK_SHIFT) - 1) >> TIMER_TICK_SHIFT;
+    u64 span = (1ull << level_shift(TIMER_LEVEL_COUNT)) - 1;
+    expires = MAX(expires, w->now + 1);
+    expires = MIN(expires, w->now + span);
+
+    timer->expires = expires;
+    timer->pending = true;
+    link(w, timer);
+    ++w->count;
+}
+
+void
+timer_cancel(Timer_Wheel *w, Timer *timer)
+{
+    if (!timer->pending) return;
+
+    unlink(w, timer);
+    timer->pending = false;
+    --w->count;
+}
+
+internal u64
+next_tick(Timer_Wheel *w)
+{
+    // NOTE(ariel) The next event of a level is either its first occupied slot
+    // to fire, at the lowest level, or to cascade, at higher levels. Scan the
+    // bitmap of each level from the slot after the current one, so the
+    // current slot, if occupied, counts as a full revolution ahead.
+    u64 next = UINT64_MAX;
+    for (u32 level = 0; level < TIMER_LEVEL_COUNT; ++level) {
+        u64 occupied = w->occupied[level];
+        if (!occupied) continue;
+
+        u64 base = w->now >> level_shift(level);
+        u32 start = (base + 1) & TIMER_LEVEL_MASK;
+        u64 rotated = start ? occupied >> start | occupied << (TIMER_LEVEL_SLOTS - start) : occupied;
+        u64 tick = (base + 1 + __builtin_ctzll(rotated)) << level_shift(level);
+        next = MIN(next, tick);
+    }
+    return next;
+}
+
+void
+timer_advance(Timer_Wheel *w, u64 now)
+{
+    u64 target = now >> TIMER_TICK_SHIFT;
+
+    while (w->now < target) {
+        // NOTE(ariel) Skip straight to the next tick with any work, so idle
+        // stretches cost nothing no matter how long they last.
+        u64 tick = w->count ? next_tick(w) : UINT64_MAX;
+        if (tick > target) {
+            w->now = target;
+            break;
+        }
+        w->now = tick;
+
+
+        /* ---
+         * Cascade every level whose slot boundary the wheel just crossed.
+         * ---
+         */
+        for (u32 level = 1; level < TIMER_LEVEL_COUNT; ++level) {
+            if (tick & ((1ull << level_shift(level)) - 1)) break;
+
+            u32 slot = (tick >> level_shift(level)) & TIMER_LEVEL_MASK;
+            Timer *timer = w->slots[level][slot];
+            w->slots[level][slot] = 0;
+            w->occupied[level] &= ~(1ull << slot);
+
+            while (timer) {
+                Timer *next = timer->next;
+                link(w, timer);
+                timer = next;
+            }
+        }
+
+
+        /* ---
+         * Fire every timer of the current slot.
+         * ---
+         */
+        u32 slot = tick & TIMER_LEVEL_MASK;
+        while (w->slots[0][slot]) {
+            Timer *timer = w->slots[0][slot];
+            unlink(w, timer);
+            timer->pending = false;
+            --w->count;
+
+            // NOTE(ariel) The timer is off the wheel before its callback runs,
+            // so the callback may start it again.
+            timer->expire(timer);
+        }
+    }
+}
+
+i64
+timer_next(Timer_Wheel *w, u64 now)
+{
+    if (!w->count) return -1;
+
+    u64 deadline = next_tick(w) << TIMER_TICK_SHIFT;
+    return deadline > now ? (i64)(deadline - now) : 0;
+}
@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err_exit.h"
+#include "stats.h"
+#include "str.h"
+#include "trace.h"
+
+_Thread_local Trace_Span t_trace = {0};
+
+global Trace_Header *g_trace_header;
+global Trace_Event *g_trace_ring;
+global u32 g_trace_sample_rate;
+global u64 g_trace_resolutions;
+
+internal _Thread_local u32 t_trace_countdown;
+
+void
+trace_init(char *path, u32 sample_rate)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) err_exit("failed to open trace file %s", path);
+
+    size_t size = sizeof(Trace_Header) + TRACE_CAPACITY * sizeof(Trace_Event);
+    if (ftruncate(fd, size) == -1) err_exit("failed to size trace file %s", path);
+
+    u8 *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == MAP_FAILED) err_exit("failed to map trace file %s", path);
+    close(fd);
+
+    g_trace_header = (Trace_Header *)buf;
+    g_trace_header->version = TRACE_VERSION;
+    g_trace_header->capacity = TRACE_CAPACITY;
+    g_trace_header->event_size = sizeof(Trace_Event);
+    __atomic_store_n(&g_trace_header->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    g_trace_ring = (Trace_Event *)(buf + sizeof(Trace_Header));
+    g_trace_sample_rate = MAX(sample_rate, 1);
+}
+
+Trace_Span
+trace_begin(String name, u16 qtype)
+{
+    Trace_Span previous = t_trace;
+
+    // NOTE(ariel) Nested resolutions, e.g. of the name of a nameserver
+    // without glue, belong to the trace of the resolution that started them.
+    if (previous.sampled || !g_trace_ring) return previous;
+
+    if (t_trace_countdown) {
+        --t_trace_countdown;
+        return previous;
+    }
+    t_trace_countdown = g_trace_sample_rate - 1;
+
+    t_trace.resolution = __atomic_add_fetch(&g_trace_resolutions, 1, __ATOMIC_RELAXED);
+    t_trace.sampled = true;
+    trace_emit(TRACE_RESOLVE_BEGIN, TRACE_REASON_NONE, 0, name, 0, qtype, 0, 0, 0);
+
+    return previous;
+}
+
+void
+trace_end(Trace_Span previous, u64 start, u16 rcode, u16 answers)
+{
+    if (t_trace.sampled && !previous.sampled) {
+        trace_emit(TRACE_RESOLVE_END, TRACE_REASON_NONE, 0, (String){0},
+                stats_now() - start, rcode, answers, 0, 0);
+    }
+    t_trace = previous;
+}
+
+void
+trace_emit(Trace_Event_Type type, Trace_Reason reason, struct sockaddr_storage *addr,
+        String name, u64 duration, u16 v0, u16 v1, u16 v2, u16 v3)
+{
+    u64 i = __atomic_fetch_add(&g_trace_header->head, 1, __ATOMIC_RELAXED);
+    Trace_Event *e = &g_trace_ring[i & (TRACE_CAPACITY - 1)];
+
+    // NOTE(ariel) An odd sequence number marks a slot as being written; the
+    // following even one tells a reader the slot holds event `i`.
+    u32 seq = (u32)(i + 1) * 2;
+    __atomic_store_n(&e->seq, seq - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    e->type = type;
+    e->reason = reason;
+    e->timestamp = stats_now();
+    e->resolution = t_trace.resolution;
+    e->duration = duration;
+    e->values[0] = v0;
+    e->values[1] = v1;
+    e->values[2] = v2;
+    e->values[3] = v3;
+
+    e->family = 0;
+    memset(e->addr, 0, sizeof(e->addr));
+    if (addr && addr->ss_family == AF_INET) {
+        e->family = AF_INET;
+        memcpy(e->addr, &((struct sockaddr_in *)addr)->sin_addr, 4);
+    } else if (addr && addr->ss_family == AF_INET6) {
+        e->family = AF_INET6;
+        memcpy(e->addr, &((struct sockaddr_in6 *)addr)->sin6_addr, 16);
+    }
+
+    e->name_len = MIN(name.len, (size_t)TRACE_NAME_LIMIT);
+    if (e->name_len) memcpy(e->name, name.str, e->name_len);
+
+    __atomic_store_n(&e->seq, seq, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err_exit.h"
+#include "trace.h"
+
+// NOTE(ariel) Decode the ring of trace events that the resolver writes with
+// `-t trace-file` and print the events of each resolution as a timeline,
+// relative to the start of the resolution.
+
+global char *RCODE_STRING[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+};
+
+internal int
+compare_events(const void *a, const void *b)
+{
+    const Trace_Event *x = a;
+    const Trace_Event *y = b;
+    if (x->resolution != y->resolution) return x->resolution < y->resolution ? -1 : 1;
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+    return 0;
+}
+
+// NOTE(ariel) Copy the slots of the ring one at a time while writers may
+// still fill them. Keep a copy only if the sequence number of its slot reads
+// the same before and after, is even, i.e. no write was under way, and marks
+// the event that the slot holds in its latest lap, i.e. no writer of a later
+// lap claimed the slot before the copy began, which would leave it torn.
+internal size_t
+copy_events(Trace_Header *header, Trace_Event *ring, Trace_Event *events)
+{
+    u32 capacity = header->capacity;
+    u64 head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+    size_t count = 0;
+    for (u32 slot = 0; slot < capacity; ++slot) {
+        u32 seq = __atomic_load_n(&ring[slot].seq, __ATOMIC_ACQUIRE);
+        memcpy(&events[count], &ring[slot], sizeof(Trace_Event));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring[slot].seq, __ATOMIC_RELAXED) != seq) continue;
+        if (!seq || (seq & 1)) continue;
+
+        // NOTE(ariel) The sequence number is twice the index of the event
+        // plus one, modulo 2^32. Recover the index relative to the head.
+        u32 lap_mask = UINT32_MAX >> 1;
+        u64 delta = ((u32)(head & lap_mask) - seq / 2) & lap_mask;
+        if (delta >= head) continue;
+        u64 index = head - delta - 1;
+        if ((index & (capacity - 1)) != slot || index + capacity < head) continue;
+
+        events[count++].seq = seq;
+    }
+    return count;
+}
+
+internal char *
+format_addr(Trace_Event *e, char *buf, socklen_t len)
+{
+    if (!e->family || !inet_ntop(e->family, e->addr, buf, len)) return "-";
+    return buf;
+}
+
+internal char *
+rcode_string(u16 rcode)
+{
+    return rcode < sizeof(RCODE_STRING) / sizeof(*RCODE_STRING) ? RCODE_STRING[rcode] : "RCODE?";
+}
+
+internal void
+print_event(Trace_Event *e, u64 origin)
+{
+    char addr[INET6_ADDRSTRLEN] = {0};
+    double at = (e->timestamp - origin) / 1e6;
+    double took = e->duration / 1e6;
+    int n = e->name_len;
+    char *name = (char *)e->name;
+
+    printf("  %+10.3f ms  ", at);
+    switch (e->type) {
+        case TRACE_RESOLVE_BEGIN:
+            printf("begin      %.*s type %u\n", n, name, e->values[0]);
+            break;
+        case TRACE_QUERY_SENT:
+            printf("query      %-40s %.*s type %u id %u%s%s\n", format_addr(e, addr, sizeof(addr)),
+                    n, name, e->values[0], e->values[1], e->values[2] ? " (retransmitted)" : "",
+                    e->reason == TRACE_REASON_FORWARD ? " (forwarded)" : "");
+            break;
+        case TRACE_REPLY_PARSED:
+            printf("parsed     %u answer, %u authority, %u additional\n",
+                    e->values[0], e->values[1], e->values[2]);
+            break;
+        case TRACE_REPLY_RECEIVED:
+            printf("reply      %-40s %s%s after %.3f ms\n", format_addr(e, addr, sizeof(addr)),
+                    rcode_string(e->values[0]), e->values[1] & 0x0400 ? " authoritative" : "", took);
+            break;
+        case TRACE_REPLY_MALFORMED:
+            printf("malformed  %-40s %u bytes\n", format_addr(e, addr, sizeof(addr)), e->values[0]);
+            break;
+        case TRACE_TIMEOUT:
+            printf("timeout    %-40s after %.3f ms\n", format_addr(e, addr, sizeof(addr)), took);
+            break;
+        case TRACE_REFERRAL:
+            printf("referral   %-40s via %.*s (%s, %u NS, %u additional)\n",
+                    format_addr(e, addr, sizeof(addr)), n, name,
+                    e->reason == TRACE_REASON_GLUE ? "glue" :
+                    e->reason == TRACE_REASON_GLUELESS ? "resolved without glue" : "local root zone",
+                    e->values[0], e->values[1]);
+            break;
+        case TRACE_RESOLVE_END:
+            printf("end        %s, %u answers in %.3f ms\n", rcode_string(e->values[0]), e->values[1], took);
+            break;
+        default:
+            printf("unknown event %u\n", e->type);
+            break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace-file\n", argv[0]);
+        exit(1);
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) err_exit("failed to open %s", argv[1]);
+
+    struct stat st = {0};
+    if (fstat(fd, &st) == -1) err_exit("failed to read size of %s", argv[1]);
+    if ((size_t)st.st_size < sizeof(Trace_Header)) {
+        errno = 0;
+        err_exit("%s is not a trace of this version of dnsresolver", argv[1]);
+    }
+
+    // NOTE(ariel) Map the ring rather than read it, so the checks of each
+    // slot see the writes of a resolver that still runs.
+    u8 *file = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED) err_exit("failed to map %s", argv[1]);
+    close(fd);
+
+    Trace_Header *header = (Trace_Header *)file;
+    u32 capacity = header->capacity;
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION || header->event_size != sizeof(Trace_Event)
+            || !capacity || (capacity & (capacity - 1))
+            || (size_t)st.st_size < sizeof(Trace_Header) + (size_t)capacity * sizeof(Trace_Event)) {
+        errno = 0;
+        err_exit("%s is not a trace of this version of dnsresolver", argv[1]);
+    }
+
+    Trace_Event *events = calloc(capacity, sizeof(Trace_Event));
+    if (!events) err_exit("failed to allocate %u events", capacity);
+    size_t valid = copy_events(header, (Trace_Event *)(file + sizeof(Trace_Header)), events);
+    munmap(file, st.st_size);
+    qsort(events, valid, sizeof(Trace_Event), compare_events);
+
+    u64 resolution = 0;
+    u64 origin = 0;
+    for (size_t i = 0; i < valid; ++i) {
+        Trace_Event *e = &events[i];
+        if (i == 0 || e->resolution != resolution) {
+            resolution = e->resolution;
+            origin = e->timestamp;
+            printf("%sresolution %llu\n", i ? "\n" : "", (unsigned long long)resolution);
+        }
+        print_event(e, origin);
+    }
+
+    free(events);
+    exit(0);
+}